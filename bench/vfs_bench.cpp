@@ -0,0 +1,628 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "vfs.h"
+#include "file.h"
+
+
+// сценарии нагрузки на VFS с машиночитаемым выводом (json или csv), чтобы сравнивать результаты между изменениями;
+// все данные и пути порождаются из --seed, поэтому повторный запуск с теми же параметрами делает то же самое
+//
+// vfs_bench [--scenarios create_deep,create_wide,seq_write,seq_read,rand_write,rand_read,concurrent_read,mount]
+//           [--files N] [--depth N] [--fanout N] [--bytes N] [--threads N] [--repeat N]
+//           [--backend stream|mmap|posix] [--chunk-size N] [--compress on|off] [--dedup on|off] [--format json|csv] [--dir path] [--out path] [--seed N]
+
+
+namespace
+{
+
+using TestTask::VFS;
+using TestTask::File;
+using TestTask::StorageBackendType;
+using std::string;
+using std::vector;
+using Clock = std::chrono::steady_clock;
+namespace fs = std::filesystem;
+
+
+struct Options
+{
+    vector<string> scenarios_ = { "create_deep", "create_wide", "seq_write", "seq_read",
+                                  "rand_write", "rand_read", "concurrent_read", "mount" };
+    size_t files_ = 10000;
+    size_t depth_ = 8;
+    size_t fanout_ = 16;
+    uint64_t bytes_ = 64 << 20;
+    size_t threads_ = 4;
+    size_t repeat_ = 5;
+    StorageBackendType backend_ = StorageBackendType::kPosix;
+    string backend_name_ = "posix";
+    size_t chunk_size_ = 4096;
+    bool compress_ = false;
+    bool dedup_ = false;
+    string format_ = "json";
+    string dir_ = "vfs_bench_data";
+    string out_;
+    uint64_t seed_ = 42;
+};
+
+
+struct Result
+{
+    string scenario_;
+    // размер одной операции в байтах, 0 - если не имеет смысла
+    uint64_t op_size_ = 0;
+    uint64_t ops_ = 0;
+    uint64_t bytes_ = 0;
+    double seconds_ = 0;
+    double p50_us_ = 0;
+    double p99_us_ = 0;
+    double max_us_ = 0;
+    // операции, которые не открыли файл или передали меньше байт, чем просили
+    uint64_t errors_ = 0;
+};
+
+
+// задержки отдельных операций; складываются в Result вместе с общим временем
+struct Latencies
+{
+    vector<double> us_;
+
+    template <typename Op>
+    auto Measure(Op&& op)
+    {
+        auto begin = Clock::now();
+        auto res = op();
+        us_.push_back(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+        return res;
+    }
+
+    void Fill(Result& result)
+    {
+        if (us_.empty())
+            return;
+
+        std::sort(us_.begin(), us_.end());
+        result.p50_us_ = us_[us_.size() / 2];
+        result.p99_us_ = us_[std::min(us_.size() - 1, us_.size() * 99 / 100)];
+        result.max_us_ = us_.back();
+    }
+};
+
+
+double seconds_since(Clock::time_point begin)
+{
+    return std::chrono::duration<double>(Clock::now() - begin).count();
+}
+
+
+string random_data(size_t size, uint64_t seed)
+{
+    std::mt19937_64 gen(seed);
+    string data(size, '\0');
+    for (size_t i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word = gen();
+        std::memcpy(&data[i], &word, sizeof(word));
+    }
+    return data;
+}
+
+
+// каждый сценарий работает в своем каталоге со своими контейнерами
+class Workspace
+{
+public:
+    Workspace(const Options& options, const string& name)
+        : dir_(fs::path(options.dir_) / name)
+    {
+        fs::remove_all(dir_);
+        fs::create_directories(dir_);
+    }
+
+    ~Workspace()
+    {
+        std::error_code ec;
+        fs::remove_all(dir_, ec);
+    }
+
+    std::unique_ptr<VFS> Mount(const Options& options) const
+    {
+        auto vfs = std::make_unique<VFS>();
+        vfs->SetStorageBackend(options.backend_);
+        vfs->SetChunkSize(options.chunk_size_);
+        vfs->SetCompression(options.compress_);
+        vfs->SetDedup(options.dedup_);
+        vfs->SetStorageFileFilenamePrefix((dir_ / "storage-").string());
+        // контейнеры не делятся по размеру, чтобы сценарии мерили работу с одним контейнером
+        vfs->SetStorageFileSizeLimit(size_t(1) << 40);
+
+        string first = (dir_ / "storage-0").string();
+        if (!fs::exists(first))
+            std::ofstream create(first);
+
+        for (size_t i = 0; fs::exists(dir_ / ("storage-" + std::to_string(i))); i++)
+            vfs->AddStorageFile((dir_ / ("storage-" + std::to_string(i))).string());
+
+        return vfs;
+    }
+
+private:
+    fs::path dir_;
+};
+
+
+string deep_path(const Options& options, size_t idx)
+{
+    string path;
+    size_t rest = idx;
+    for (size_t level = 0; level + 1 < options.depth_; level++)
+    {
+        path += "d" + std::to_string(rest % options.fanout_) + "/";
+        rest /= options.fanout_;
+    }
+    return path + "f" + std::to_string(idx);
+}
+
+
+string wide_path(const Options& options, size_t idx)
+{
+    return "w" + std::to_string(idx % options.fanout_) + "/f" + std::to_string(idx);
+}
+
+
+Result create_files(const Options& options, const string& scenario, const std::function<string(size_t)>& path_of)
+{
+    Workspace ws(options, scenario);
+    auto vfs = ws.Mount(options);
+
+    string payload = random_data(256, options.seed_);
+    Result result{ scenario, payload.size() };
+    Latencies latencies;
+
+    auto begin = Clock::now();
+    for (size_t i = 0; i < options.files_; i++)
+    {
+        string path = path_of(i);
+        size_t written = latencies.Measure([&]
+        {
+            File* f = vfs->Create(path.c_str());
+            size_t written = f ? vfs->Write(f, payload.data(), payload.size()) : 0;
+            if (f)
+                vfs->Close(f);
+            return written;
+        });
+        result.bytes_ += written;
+        result.errors_ += written != payload.size();
+    }
+    result.seconds_ = seconds_since(begin);
+    result.ops_ = options.files_;
+    latencies.Fill(result);
+
+    return result;
+}
+
+
+void write_file(VFS& vfs, const string& path, const string& data, size_t op_size)
+{
+    File* f = vfs.Create(path.c_str());
+    for (size_t pos = 0; f && pos < data.size(); pos += op_size)
+        vfs.Write(f, const_cast<char*>(data.data() + pos), std::min(op_size, data.size() - pos));
+    if (f)
+        vfs.Close(f);
+}
+
+
+vector<Result> seq_write(const Options& options, const vector<size_t>& sizes)
+{
+    vector<Result> results;
+    string data = random_data(options.bytes_, options.seed_);
+
+    for (auto size : sizes)
+    {
+        Workspace ws(options, "seq_write");
+        auto vfs = ws.Mount(options);
+
+        Result result{ "seq_write", size };
+        Latencies latencies;
+
+        auto begin = Clock::now();
+        File* f = vfs->Create("seq/data");
+        for (size_t pos = 0; f && pos < data.size(); pos += size)
+        {
+            size_t len = std::min(size, data.size() - pos);
+            size_t written = latencies.Measure([&] { return vfs->Write(f, const_cast<char*>(data.data() + pos), len); });
+            result.bytes_ += written;
+            result.errors_ += written != len;
+            ++result.ops_;
+        }
+        result.errors_ += f == nullptr;
+        if (f)
+            vfs->Close(f);
+        result.seconds_ = seconds_since(begin);
+
+        latencies.Fill(result);
+        results.push_back(result);
+    }
+
+    return results;
+}
+
+
+vector<Result> seq_read(const Options& options, const vector<size_t>& sizes)
+{
+    vector<Result> results;
+    Workspace ws(options, "seq_read");
+    {
+        auto vfs = ws.Mount(options);
+        write_file(*vfs, "seq/data", random_data(options.bytes_, options.seed_), 1 << 20);
+    }
+
+    for (auto size : sizes)
+    {
+        auto vfs = ws.Mount(options);
+        vector<char> buf(size);
+
+        Result result{ "seq_read", size };
+        Latencies latencies;
+
+        auto begin = Clock::now();
+        File* f = vfs->Open("seq/data");
+        size_t read = 0;
+        do
+        {
+            read = f ? latencies.Measure([&] { return vfs->Read(f, buf.data(), buf.size()); }) : 0;
+            result.bytes_ += read;
+            ++result.ops_;
+        }
+        while (read == size);
+        result.errors_ += result.bytes_ != options.bytes_;
+        if (f)
+            vfs->Close(f);
+        result.seconds_ = seconds_since(begin);
+
+        latencies.Fill(result);
+        results.push_back(result);
+    }
+
+    return results;
+}
+
+
+vector<Result> random_io(const Options& options, const vector<size_t>& sizes, bool write)
+{
+    vector<Result> results;
+    string scenario = write ? "rand_write" : "rand_read";
+
+    Workspace ws(options, scenario);
+    string data = random_data(options.bytes_, options.seed_);
+    {
+        auto vfs = ws.Mount(options);
+        write_file(*vfs, "rand/data", data, 1 << 20);
+    }
+
+    for (auto size : sizes)
+    {
+        auto vfs = ws.Mount(options);
+        vector<char> buf(size);
+        std::mt19937_64 gen(options.seed_ + size);
+        uint64_t slots = std::max<uint64_t>(data.size() / size, 1);
+
+        Result result{ scenario, size };
+        Latencies latencies;
+
+        // столько же операций, сколько нужно, чтобы один раз пройти файл целиком
+        File* f = write ? vfs->Create("rand/data") : vfs->Open("rand/data");
+        if (!f)
+        {
+            result.errors_ = 1;
+            results.push_back(result);
+            continue;
+        }
+        if (write)
+            vfs->Write(f, data.data(), data.size());
+
+        auto begin = Clock::now();
+        for (uint64_t i = 0; i < slots; i++)
+        {
+            uint64_t offset = (gen() % slots) * size;
+            size_t len = std::min<uint64_t>(size, data.size() - offset);
+            size_t done = write ? latencies.Measure([&] { return vfs->WriteAt(f, offset, data.data() + offset, len); })
+                                : latencies.Measure([&] { return vfs->ReadAt(f, offset, buf.data(), len); });
+            result.bytes_ += done;
+            result.errors_ += done != len;
+            ++result.ops_;
+        }
+        result.seconds_ = seconds_since(begin);
+        vfs->Close(f);
+
+        latencies.Fill(result);
+        results.push_back(result);
+    }
+
+    return results;
+}
+
+
+Result concurrent_read(const Options& options, size_t size)
+{
+    Workspace ws(options, "concurrent_read");
+    uint64_t per_thread = std::max<uint64_t>(options.bytes_ / options.threads_, size);
+    {
+        auto vfs = ws.Mount(options);
+        for (size_t t = 0; t < options.threads_; t++)
+            write_file(*vfs, "par/data" + std::to_string(t), random_data(per_thread, options.seed_ + t), 1 << 20);
+    }
+
+    auto vfs = ws.Mount(options);
+    vector<Latencies> latencies(options.threads_);
+    vector<uint64_t> bytes(options.threads_, 0);
+    vector<std::thread> threads;
+
+    auto begin = Clock::now();
+    for (size_t t = 0; t < options.threads_; t++)
+    {
+        threads.emplace_back([&, t]
+        {
+            vector<char> buf(size);
+            string path = "par/data" + std::to_string(t);
+            File* f = vfs->Open(path.c_str());
+            if (!f)
+                return;
+
+            size_t read = 0;
+            do
+            {
+                read = latencies[t].Measure([&] { return vfs->Read(f, buf.data(), buf.size()); });
+                bytes[t] += read;
+            }
+            while (read == size);
+            vfs->Close(f);
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    Result result{ "concurrent_read", size };
+    result.seconds_ = seconds_since(begin);
+
+    Latencies all;
+    for (size_t t = 0; t < options.threads_; t++)
+    {
+        result.bytes_ += bytes[t];
+        result.errors_ += bytes[t] != per_thread;
+        all.us_.insert(all.us_.end(), latencies[t].us_.begin(), latencies[t].us_.end());
+    }
+    result.ops_ = all.us_.size();
+    all.Fill(result);
+
+    return result;
+}
+
+
+// время от создания VFS до первого открытого файла на контейнере с files_ файлами
+Result mount(const Options& options)
+{
+    Workspace ws(options, "mount");
+    {
+        auto vfs = ws.Mount(options);
+        string payload = random_data(64, options.seed_);
+        for (size_t i = 0; i < options.files_; i++)
+            write_file(*vfs, deep_path(options, i), payload, payload.size());
+    }
+
+    Result result{ "mount", 0 };
+    Latencies latencies;
+    string probe = deep_path(options, options.files_ / 2);
+
+    auto begin = Clock::now();
+    for (size_t i = 0; i < options.repeat_; i++)
+    {
+        bool opened = latencies.Measure([&]
+        {
+            auto vfs = ws.Mount(options);
+            File* f = vfs->Open(probe.c_str());
+            if (f)
+                vfs->Close(f);
+            return f != nullptr;
+        });
+        result.errors_ += !opened;
+        ++result.ops_;
+    }
+    result.seconds_ = seconds_since(begin);
+    latencies.Fill(result);
+
+    return result;
+}
+
+
+void print_json(std::ostream& os, const Options& options, const vector<Result>& results)
+{
+    os << std::fixed << std::setprecision(3);
+    os << "{\n";
+    os << "  \"bench\": \"vfs_bench\",\n";
+    os << "  \"backend\": \"" << options.backend_name_ << "\",\n";
+    os << "  \"chunk_size\": " << options.chunk_size_ << ",\n";
+    os << "  \"compress\": " << (options.compress_ ? "true" : "false") << ",\n";
+    os << "  \"dedup\": " << (options.dedup_ ? "true" : "false") << ",\n";
+    os << "  \"files\": " << options.files_ << ",\n";
+    os << "  \"depth\": " << options.depth_ << ",\n";
+    os << "  \"fanout\": " << options.fanout_ << ",\n";
+    os << "  \"bytes\": " << options.bytes_ << ",\n";
+    os << "  \"threads\": " << options.threads_ << ",\n";
+    os << "  \"seed\": " << options.seed_ << ",\n";
+    os << "  \"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const auto& r = results[i];
+        os << "    {\"scenario\": \"" << r.scenario_ << "\", \"op_size\": " << r.op_size_
+           << ", \"ops\": " << r.ops_ << ", \"bytes\": " << r.bytes_ << ", \"seconds\": " << r.seconds_
+           << ", \"ops_per_sec\": " << (r.seconds_ > 0 ? r.ops_ / r.seconds_ : 0)
+           << ", \"mb_per_sec\": " << (r.seconds_ > 0 ? r.bytes_ / r.seconds_ / (1 << 20) : 0)
+           << ", \"p50_us\": " << r.p50_us_ << ", \"p99_us\": " << r.p99_us_ << ", \"max_us\": " << r.max_us_ << ", \"errors\": " << r.errors_ << "}"
+           << (i + 1 == results.size() ? "\n" : ",\n");
+    }
+
+    os << "  ]\n}\n";
+}
+
+
+void print_csv(std::ostream& os, const Options& options, const vector<Result>& results)
+{
+    os << std::fixed << std::setprecision(3);
+    os << "scenario,backend,chunk_size,compress,dedup,op_size,ops,bytes,seconds,ops_per_sec,mb_per_sec,p50_us,p99_us,max_us,errors\n";
+
+    for (const auto& r : results)
+    {
+        os << r.scenario_ << "," << options.backend_name_ << "," << options.chunk_size_ << "," << options.compress_ << "," << options.dedup_ << "," << r.op_size_ << "," << r.ops_ << "," << r.bytes_ << ","
+           << r.seconds_ << "," << (r.seconds_ > 0 ? r.ops_ / r.seconds_ : 0) << ","
+           << (r.seconds_ > 0 ? r.bytes_ / r.seconds_ / (1 << 20) : 0) << ","
+           << r.p50_us_ << "," << r.p99_us_ << "," << r.max_us_ << "," << r.errors_ << "\n";
+    }
+}
+
+
+bool parse_options(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string key = argv[i];
+        if (i + 1 >= argc)
+        {
+            std::cerr << "missing value for " << key << std::endl;
+            return false;
+        }
+        string value = argv[++i];
+
+        if (key == "--scenarios")
+        {
+            options.scenarios_.clear();
+            std::stringstream list(value);
+            for (string name; std::getline(list, name, ',');)
+                options.scenarios_.push_back(name);
+        }
+        else if (key == "--files")
+            options.files_ = std::stoull(value);
+        else if (key == "--depth")
+            options.depth_ = std::max<size_t>(std::stoull(value), 1);
+        else if (key == "--fanout")
+            options.fanout_ = std::max<size_t>(std::stoull(value), 1);
+        else if (key == "--bytes")
+            options.bytes_ = std::max<uint64_t>(std::stoull(value), 1);
+        else if (key == "--threads")
+            options.threads_ = std::max<size_t>(std::stoull(value), 1);
+        else if (key == "--repeat")
+            options.repeat_ = std::max<size_t>(std::stoull(value), 1);
+        else if (key == "--seed")
+            options.seed_ = std::stoull(value);
+        else if (key == "--dir")
+            options.dir_ = value;
+        else if (key == "--out")
+            options.out_ = value;
+        else if (key == "--chunk-size" && VFS::ValidChunkSize(std::stoull(value)))
+            options.chunk_size_ = std::stoull(value);
+        else if (key == "--compress" && (value == "on" || value == "off"))
+            options.compress_ = value == "on";
+        else if (key == "--dedup" && (value == "on" || value == "off"))
+            options.dedup_ = value == "on";
+        else if (key == "--format" && (value == "json" || value == "csv"))
+            options.format_ = value;
+        else if (key == "--backend" && (value == "stream" || value == "mmap" || value == "posix"))
+        {
+            options.backend_name_ = value;
+            options.backend_ = value == "stream" ? StorageBackendType::kStream
+                             : value == "mmap" ? StorageBackendType::kMmap
+                             : StorageBackendType::kPosix;
+        }
+        else
+        {
+            std::cerr << "unknown option " << key << " " << value << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+}
+
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parse_options(argc, argv, options))
+        return 2;
+
+    const vector<size_t> sizes = { 4 << 10, 64 << 10, 1 << 20 };
+    const vector<size_t> random_sizes = { 4 << 10, 64 << 10 };
+
+    vector<Result> results;
+    auto append = [&results](vector<Result> more)
+    {
+        results.insert(results.end(), more.begin(), more.end());
+    };
+
+    for (const auto& scenario : options.scenarios_)
+    {
+        std::cerr << "running " << scenario << std::endl;
+
+        if (scenario == "create_deep")
+            results.push_back(create_files(options, scenario, [&](size_t i) { return deep_path(options, i); }));
+        else if (scenario == "create_wide")
+            results.push_back(create_files(options, scenario, [&](size_t i) { return wide_path(options, i); }));
+        else if (scenario == "seq_write")
+            append(seq_write(options, sizes));
+        else if (scenario == "seq_read")
+            append(seq_read(options, sizes));
+        else if (scenario == "rand_write")
+            append(random_io(options, random_sizes, true));
+        else if (scenario == "rand_read")
+            append(random_io(options, random_sizes, false));
+        else if (scenario == "concurrent_read")
+            results.push_back(concurrent_read(options, 64 << 10));
+        else if (scenario == "mount")
+            results.push_back(mount(options));
+        else
+        {
+            std::cerr << "unknown scenario " << scenario << std::endl;
+            return 2;
+        }
+    }
+
+    std::ofstream out_file;
+    if (!options.out_.empty())
+        out_file.open(options.out_);
+    std::ostream& out = options.out_.empty() ? std::cout : out_file;
+
+    if (options.format_ == "csv")
+        print_csv(out, options, results);
+    else
+        print_json(out, options, results);
+
+    std::error_code ec;
+    fs::remove(options.dir_, ec);
+
+    // сбойные операции искажают замеры, поэтому такой прогон считается неудачным
+    for (const auto& r : results)
+    {
+        if (r.errors_ != 0)
+        {
+            std::cerr << r.scenario_ << ": " << r.errors_ << " failed operations" << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
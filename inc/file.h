@@ -1,5 +1,8 @@
 #pragma once
 #include <cinttypes>
+#include <string>
+#include <mutex>
+#include <vector>
 
 namespace TestTask
 {
@@ -11,12 +14,50 @@ enum class FileMode
     kWriteOnly,
 };
 
+// непрерывный участок файла в контейнере: start_ - позиция первого чанка, length_ - количество чанков
+struct FileExtent
+{
+    uint64_t start_ = 0;
+    uint64_t length_ = 0;
+};
+
+// место файла в наборе полос: чередующиеся куски по unit_ байт лежат
+// в count_ контейнерах по кругу, index_ - номер полосы в этом контейнере
+struct FileStripe
+{
+    uint32_t index_ = 0;
+    uint32_t count_ = 1;
+    uint64_t unit_ = 0;
+};
+
 struct File
 {
     FileMode mode_ = FileMode::kReadOnly;
     uint64_t first_chunk_ = 0;
-    uint64_t last_pos_ = 0;
-    uint64_t last_chunk_ = 0;
+    uint64_t pos_ = 0;
+    uint64_t size_ = 0;
+    size_t storage_ = 0;
+    std::string path_;
+    // копия экстентов файла на момент открытия (у пишущего - дополняется при записи)
+    std::vector<FileExtent> extents_;
+    // позиция каждого чанка файла по его номеру, строится по extents_ при первом обращении
+    std::vector<uint64_t> chunk_index_;
+    // хвост записи, не дотянувший до конца чанка; логически лежит сразу за pos_
+    std::string pending_;
+    // пока экстентов нет, содержимое файла целиком здесь (копия из дерева);
+    // у пишущего - до inline_limit_ байт, дальше оно переезжает в чанки
+    std::string inline_data_;
+    uint64_t inline_limit_ = 0;
+    // последний распакованный чанк (номер в файле и содержимое), чтобы мелкие чтения
+    // подряд из сжатого контейнера не распаковывали его заново
+    uint64_t unpacked_idx_ = uint64_t(-1);
+    std::string unpacked_;
+    // у файла, разбитого на полосы, - открытые полосы по порядку (ими владеет этот File),
+    // а pos_ и size_ считаются по всему файлу
+    std::vector<File*> stripes_;
+    uint64_t stripe_unit_ = 0;
+    // позиция выше своя у каждого открытого File, параллельные вызовы с одним File идут по очереди
+    std::mutex m_;
     // uint64_t last_read_pos_ = 0;
     // uint64_t last_write_pos_ = 0;
 };
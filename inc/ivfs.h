@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
 
 namespace TestTask
 {
@@ -14,6 +16,12 @@ struct IVFS
 	virtual size_t Read( File *f, char *buff, size_t len ) = 0; // Прочитать данные из файла. Возвращаемое значение - сколько реально байт удалось прочитать
 	virtual size_t Write( File *f, char *buff, size_t len ) = 0; // Записать данные в файл. Возвращаемое значение - сколько реально байт удалось записать
 	virtual void Close( File *f ) = 0; // Закрыть файл	
+	virtual bool Seek( File *f, uint64_t offset ) = 0; // Переставить позицию чтения/записи. Дальше конца файла переставить нельзя - вернуть false
+	virtual uint64_t Tell( File *f ) = 0; // Текущая позиция чтения/записи
+	virtual size_t ReadAt( File *f, uint64_t offset, char *buff, size_t len ) = 0; // Прочитать данные с позиции offset, текущая позиция не меняется
+	virtual size_t WriteAt( File *f, uint64_t offset, const char *buff, size_t len ) = 0; // Записать данные с позиции offset (не дальше конца файла), текущая позиция не меняется
+	virtual size_t WriteV( File *f, const iovec *iov, size_t count ) = 0; // Записать несколько буферов подряд. Возвращаемое значение - сколько всего байт удалось записать
+	virtual size_t WriteBatch( File *const *files, const iovec *iov, size_t count ) = 0; // Записать iov[i] в files[i], записи в один файл идут одной пачкой. Возвращаемое значение - сколько всего байт удалось записать
 };
 
 }
\ No newline at end of file
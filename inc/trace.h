@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cinttypes>
+#include <atomic>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <memory>
+
+
+// уровень трассировки задается при сборке: 0 - выключена (макросы ничего не компилируют),
+// 1 - ошибки, 2 - основные события, 3 - подробно (каждая нода, каждый чанк)
+#ifndef VFS_TRACE_LEVEL
+#define VFS_TRACE_LEVEL 0
+#endif
+
+// маска категорий, которые попадают в сборку (см. TraceCategory)
+#ifndef VFS_TRACE_CATEGORIES
+#define VFS_TRACE_CATEGORIES 0xFF
+#endif
+
+
+namespace TestTask
+{
+
+enum class TraceLevel : uint8_t
+{
+    kOff = 0,
+    kError = 1,
+    kInfo = 2,
+    kDebug = 3,
+};
+
+enum class TraceCategory : uint8_t
+{
+    kTree = 1,
+    kChunk = 2,
+    kAlloc = 4,
+    kIo = 8,
+};
+
+
+constexpr bool trace_enabled(TraceCategory category, TraceLevel level)
+{
+    return uint8_t(level) <= VFS_TRACE_LEVEL && (uint8_t(category) & VFS_TRACE_CATEGORIES) != 0;
+}
+
+
+// кольцевой буфер записей трассировки; писатели не ждут друг друга и читателя,
+// старые записи перезаписываются новыми, а запись, чей слот еще пишет другой писатель, теряется
+class TraceBuffer
+{
+public:
+    static constexpr size_t kCapacity = 4096;
+    static constexpr size_t kTextSize = 104;
+
+    struct Record
+    {
+        // 0 - слот пуст, нечетное - запись в процессе, четное - номер записи * 2 + 2
+        std::atomic<uint64_t> seq_{0};
+        uint64_t time_ns_ = 0;
+        TraceLevel level_ = TraceLevel::kOff;
+        TraceCategory category_ = TraceCategory::kTree;
+        char text_[kTextSize] = {};
+    };
+
+
+    static TraceBuffer& Instance();
+
+    void Push(TraceCategory category, TraceLevel level, const std::string& text);
+
+    // выводит сохранившиеся записи по порядку; может идти параллельно с Push
+    void Dump(std::ostream& os) const;
+
+    // сколько записей было передано в Push, включая потерянные
+    size_t Pushed() const;
+
+private:
+    std::atomic<uint64_t> head_{0};
+    std::unique_ptr<Record[]> records_ = std::make_unique<Record[]>(kCapacity);
+};
+
+
+const char* trace_category_name(TraceCategory category);
+
+}
+
+
+#if VFS_TRACE_LEVEL > 0
+
+#define VFS_TRACE(category, level, message)                                                            \
+    do                                                                                                 \
+    {                                                                                                  \
+        if constexpr (::TestTask::trace_enabled(::TestTask::TraceCategory::category,                   \
+                                                ::TestTask::TraceLevel::level))                        \
+        {                                                                                              \
+            std::ostringstream trace_os_;                                                              \
+            trace_os_ << message;                                                                      \
+            ::TestTask::TraceBuffer::Instance().Push(::TestTask::TraceCategory::category,              \
+                                                     ::TestTask::TraceLevel::level, trace_os_.str());  \
+        }                                                                                              \
+    } while (0)
+
+#else
+
+#define VFS_TRACE(category, level, message) do {} while (0)
+
+#endif
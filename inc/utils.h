@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cinttypes>
+#include <cstring>
 #include <fstream>
 #include <string>
 #include <iostream>
@@ -14,6 +15,7 @@ namespace TestTask
 {
 
 using std::fstream;
+using std::iostream;
 
 extern bool little_endian;
 
@@ -52,56 +54,178 @@ Integer little_endian2local(Integer num)
 }
 
 template <typename Integer>
-fstream& write_integer(Integer num, fstream& stream)
+char* store_integer(Integer num, char* buf)
 {
     num = local2little_endian(num);
-    stream.write((const char*)&num, sizeof(num));
-    return stream;
+    std::memcpy(buf, &num, sizeof(num));
+    return buf + sizeof(num);
 }
 
 template <typename Integer>
-fstream& read_integer(Integer& num, fstream& stream)
+const char* load_integer(Integer& num, const char* buf)
 {
-    stream.read((char*)&num, sizeof(num));
+    std::memcpy(&num, buf, sizeof(num));
     num = little_endian2local(num);
-    return stream;
+    return buf + sizeof(num);
 }
 
-static inline fstream& fill_bytes(size_t amount, char byte, fstream& stream)
+// запись метаданных в буфер в памяти; в контейнер буфер уходит одним обращением
+class BinaryWriter
 {
-    for (size_t i = 0; i < amount; i++)
-        stream.put(byte);
-    return stream;
-}
+public:
+    template <typename Integer>
+    void Write(Integer num)
+    {
+        char buf[sizeof(num)];
+        store_integer(num, buf);
+        data_.append(buf, sizeof(buf));
+    }
+
+    // дописать поле на уже занятое место, например смещение, известное только после записи
+    template <typename Integer>
+    void WriteAt(size_t pos, Integer num)
+    {
+        if (pos + sizeof(num) <= data_.size())
+            store_integer(num, &data_[pos]);
+    }
+
+    void WriteString(const std::string& str)
+    {
+        data_.append(str.c_str(), str.size() + 1);
+    }
 
-static inline fstream& read_string(std::string& str, fstream& stream)
+    // произвольные байты (в том числе \0): сначала uint32 длина, потом сами байты
+    void WriteBytes(const std::string& bytes)
+    {
+        Write(uint32_t(bytes.size()));
+        data_.append(bytes);
+    }
+
+    void Fill(size_t amount, char byte)
+    {
+        data_.append(amount, byte);
+    }
+
+    size_t Tell() const
+    {
+        return data_.size();
+    }
+
+    const std::string& Data() const
+    {
+        return data_;
+    }
+
+    std::string Take()
+    {
+        return std::move(data_);
+    }
+
+private:
+    std::string data_;
+};
+
+
+// чтение метаданных из буфера в памяти; выход за границу буфера
+// не бросает исключений, а переводит читатель в ошибку, как failbit у потоков
+class BinaryReader
 {
-    auto pos = stream.tellg();
+public:
+    BinaryReader(const char* data, size_t size)
+        : data_(data), size_(size)
+    {
+    }
 
-    char c = 'a';
-    size_t len = 0;
+    explicit BinaryReader(const std::string& data)
+        : BinaryReader(data.data(), data.size())
+    {
+    }
 
-    while (c != '\0' && !stream.eof() && stream.good())
+    template <typename Integer>
+    bool Read(Integer& num)
     {
-        // std::cout << "read c=" << c << " int=" << int(c) << std::endl;
-        // std::cout << "eof: " << stream.eof() << " good: " << stream.good() << std::endl;
-        stream.get(c);
-        ++len;
+        if (!good_ || size_ - pos_ < sizeof(num))
+        {
+            num = 0;
+            return good_ = false;
+        }
+
+        load_integer(num, data_ + pos_);
+        pos_ += sizeof(num);
+        return true;
     }
-    
-    stream.seekg(pos);
 
-    if (len != 0)
+    bool ReadString(std::string& str)
     {
-        auto buf = std::unique_ptr<char>(new char[len]);
-        stream.read(buf.get(), len);
-        str = std::string(buf.get(), len - 1);
+        const void* end = good_ ? std::memchr(data_ + pos_, '\0', size_ - pos_) : nullptr;
+        if (end == nullptr)
+            return good_ = false;
 
-        // std::cout << "READ STRING SIZE=" << len << "   STR=" << str << std::endl;
+        size_t len = static_cast<const char*>(end) - (data_ + pos_);
+        str.assign(data_ + pos_, len);
+        pos_ += len + 1;
+        return true;
     }
 
-    return stream;
-}
+    bool ReadBytes(std::string& bytes)
+    {
+        uint32_t len = 0;
+        if (!Read(len) || size_ - pos_ < len)
+        {
+            bytes.clear();
+            return good_ = false;
+        }
+
+        bytes.assign(data_ + pos_, len);
+        pos_ += len;
+        return true;
+    }
+
+    void Seek(size_t pos)
+    {
+        if (pos > size_)
+            good_ = false;
+        else
+            pos_ = pos;
+    }
+
+    size_t Tell() const
+    {
+        return pos_;
+    }
+
+    size_t Size() const
+    {
+        return size_;
+    }
+
+    bool AtEnd() const
+    {
+        return pos_ == size_;
+    }
+
+    bool Good() const
+    {
+        return good_;
+    }
+
+    void Fail()
+    {
+        good_ = false;
+    }
+
+    void Clear()
+    {
+        good_ = true;
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t pos_ = 0;
+    bool good_ = true;
+};
+
 
 static inline std::vector<std::string> split_string(const std::string& src, char delim, bool take_empty=false) 
 {
@@ -136,7 +260,7 @@ static inline std::vector<std::string> split_string(const std::string& src, char
     return res;
 }
 
-static inline bool is_stream_empty(fstream& stream)
+static inline bool is_stream_empty(iostream& stream)
 {
     auto pos = stream.tellg();
     stream.seekg(0, std::ios::end);
@@ -145,7 +269,7 @@ static inline bool is_stream_empty(fstream& stream)
     return empty;
 }
 
-static inline size_t stream_size(fstream& stream)
+static inline size_t stream_size(iostream& stream)
 {
     auto pos = stream.tellg();
     stream.seekg(0, std::ios::end);
@@ -5,15 +5,28 @@
 #include <string_view>
 #include <vector>
 #include <mutex>
+#include <shared_mutex>
+#include <deque>
 #include <cinttypes>
 #include <memory>
 #include <functional>
 #include <stack>
 #include <map>
+#include <list>
+#include <atomic>
+#include <unordered_map>
+#include <algorithm>
+#include <sstream>
+#include <variant>
+#include <thread>
+#include <condition_variable>
+#include <future>
+#include <array>
 
 #include "ivfs.h"
 #include "utils.h"
 #include "file.h"
+#include "trace.h"
 
 
 using std::cout;
@@ -29,71 +42,195 @@ using std::initializer_list;
 using std::string;
 using std::string_view;
 using std::fstream;
+using std::iostream;
+using std::stringstream;
 using std::mutex;
+using std::shared_mutex;
+using std::shared_lock;
+using std::unique_lock;
+using std::lock_guard;
+using std::deque;
 using std::shared_ptr;
 using std::make_shared;
+using std::unique_ptr;
 using std::function;
 using std::ostream;
 using std::map;
+using std::list;
+using std::atomic;
+using std::unordered_map;
+using std::thread;
+using std::condition_variable;
+using std::future;
+using std::promise;
+
+
+enum class StorageBackendType
+{
+    kStream,
+    kMmap,
+    kPosix,
+};
+
+// как выбирать контейнер для нового файла
+enum class PlacementPolicy
+{
+    kFirstFit,          // первый контейнер, где есть место
+    kLeastFull,         // наименее заполненный
+    kParentLocality,    // тот, где уже есть папка файла, иначе наименее заполненный
+};
 
 
 struct VFS : IVFS
 {
 private:
-    static constexpr size_t kChunkSize = 4096;
-    static constexpr size_t kMinimumStorageFileSize = kChunkSize * 2;
-    static constexpr size_t kDefaultStorageFileSizeLimit = kChunkSize * 4096;
+    // размер чанка выбирается при создании контейнера и хранится в его заголовке
+    static constexpr size_t kDefaultChunkSize = 4096;
+    static constexpr size_t kMinChunkSize = 512;
+    static constexpr size_t kMaxChunkSize = 1 << 20;
+    static constexpr size_t kMinimumStorageFileSize = kDefaultChunkSize * 2;
+    // когда все контейнеры заполнены больше чем на столько процентов, следующий создается заранее
+    static constexpr size_t kRolloverFillPercent = 90;
+    static constexpr size_t kDefaultStorageFileSizeLimit = kDefaultChunkSize * 4096;
+    static constexpr size_t kDefaultChunkCachePages = 1024;
+    static constexpr size_t kDefaultIoThreads = 4;
     static constexpr std::string_view kDefaultStorageFilePrefix = "storage-";
     static constexpr uint64_t kInvalidPos = 0;
     static constexpr char kPathDelimeter = '/';
+    static constexpr uint32_t kStorageMagic = 0x53465654;
+    static constexpr uint16_t kStorageVersion = 11;
+    static constexpr size_t kChunkHeaderSize = 34;
+    static constexpr size_t kDefaultChunkPayloadSize = kDefaultChunkSize - kChunkHeaderSize;
+    static constexpr uint64_t kJournalCheckpointSize = 16 * kDefaultChunkPayloadSize;
+    // сколько чанков экстента читается/пишется одним обращением к контейнеру
+    static constexpr size_t kMaxRunChunks = 64;
+    // размер куска полосы по умолчанию, всегда кратен полезной части чанка
+    static constexpr size_t kDefaultStripeUnit = 16 * kDefaultChunkPayloadSize;
+    // файлы не больше порога хранятся прямо в своей ноде дерева, без чанков
+    static constexpr size_t kDefaultInlineThreshold = 256;
 public:
 
-// дерево
-// |        uint64          |                      |                |
-// | размер дерева в байтах | первая нода (корень) | другие ноды... |
+// заголовок контейнера (нулевой чанк, всегда на одном месте; все чанки контейнера одного размера)
+// |     uint32     |  uint16  |     uint32    |                 bool                 |                  bool                   |             uint64            |        uint64        |             uint64             |        uint64         |        uint64        |                 uint64                |              uint64               |
+// | магическое число | версия | размер чанка | сжимать ли содержимое новых чанков | делить ли одинаковые чанки между файлами | указатель на первый чанк дерева | размер дерева в байтах | указатель на первый чанк журнала | размер журнала в байтах | количество чанков | указатель на первый чанк битовой карты | размер цепочки карты в байтах |
+
+
+// битовая карта занятых чанков (цепочка чанков, 1 - занят; все чанки цепочки заполнены целиком,
+// значимы первые (количество чанков + 7) / 8 байт; цепочка удлиняется на чанк, когда карта в нее не влезает)
+// |             N байт            |
+// | биты чанков, младший бит - первый |
+
+
+// журнал изменений дерева (цепочка чанков, записи дописываются в конец;
+// при открытии контейнера применяются поверх последней контрольной точки дерева,
+// когда журнал дорастает до kJournalCheckpointSize - дерево записывается целиком, журнал очищается)
+// |                  uint16                     |            uint64             |        uint64         |                  ? байт                  |          uint64          |        16 * N байт         |       uint32        |        uint32        |           uint64           |        uint32           |           N байт           |
+// | тип записи (добавление/изменение файла) | указатель на первый чанк файла | размер контента файла | полный путь файла оканчивающийся на \0 | количество экстентов файла | экстенты (начало, длина) | номер полосы файла | количество полос | размер куска полосы в байтах | размер встроенного контента | встроенный контент (у файла без экстентов) |
+
+// дерево (лежит в цепочке чанков, как обычный файл, на которую указывает заголовок контейнера;
+// указатели на ноды - смещения от начала дерева)
+// |        uint64          |                  |                      |                |
+// | размер дерева в байтах | таблица имен нод | первая нода (корень) | другие ноды... |
+
+
+// таблица имен (номер имени - его порядковый номер в таблице)
+// |     uint64      |                  ? байт                  |
+// | количество имен | имена подряд, каждое оканчивается на \0 |
 
 
 // нода
 // |      uint16      |
 // | тип (папка/файл) |
-// |                  |         uint64                    |                ? байт                    |              8 * N байт                          |
-// |       для папки: | количество поддиректорий и файлов | название директории оканчивающееся на \0 | массив указателей на ноды поддиректорий и файлов | 
-// |                  |         uint64                    |                uint64                    |                   ? байт                         |
-// |       для файла: | указатель на первый чанк файла    |             размер контента файла        |     название файла оканчивающееся на \0          | 
+// |                  |         uint64                    |                uint32                    |              8 * N байт                          |
+// |       для папки: | количество поддиректорий и файлов | номер названия директории в таблице имен | массив указателей на ноды поддиректорий и файлов | 
+// |                  |         uint64                    |                uint64                    |                   uint32                         |          uint64          |               16 * N байт                         |       uint32        |        uint32        |           uint64           |          uint32           |           N байт           |
+// |       для файла: | указатель на первый чанк файла    |             размер контента файла        |     номер названия файла в таблице имен          | количество экстентов | экстенты: позиция первого чанка и количество чанков | номер полосы файла | количество полос (1 - файл целиком здесь) | размер куска полосы в байтах | размер встроенного контента | встроенный контент (у файла без экстентов) |
 
 
-// собственно файл
-// |            bool               |         bool               |                               uint64                                   |                      uint64                     |  kChunkSize - 1 - 1 - 1 - 8 - 8 = 4077 байт |
-// | используется ли чанк (да/нет) | последний ли чанк (да/нет) | количество используемых под контент байт в этом чанке (если последний) | указатель на следующий чанк (если не последний) |           непосредственно контент           |
+// собственно файл - набор экстентов (подряд идущих чанков), у каждого чанка свой заголовок;
+// для файлов размер контента берется из дерева, а цепочка next используется только деревом и журналом
+// |                  uint32                  |         bool               |                               uint64                                   |                      uint64                     |          uint8            |              uint32                 |                    uint64                     | размер чанка - 4 - 1 - 8 - 8 - 1 - 4 - 8 (4062 байта у чанка в 4096) |
+// | сколько файлов ссылается на чанк (0 - свободен) | последний ли чанк (да/нет) | количество используемых под контент байт в этом чанке (если последний) | указатель на следующий чанк (если не последний) | флаги (1 - контент сжат) | размер сжатого контента (если сжат) | отпечаток полного чанка (0 - не индексируется) |               непосредственно контент (used_ или stored_ байт)               |
 
 
 
     struct FileTree
     {
-        struct TreeNode;
-        using NodeProcessor = function<void(const shared_ptr<TreeNode>&)>;
-        using ConstNodeProcessor = function<void(const shared_ptr<const TreeNode>&)>;
-
+        // ноды лежат в одном массиве и ссылаются друг на друга по 32-битным номерам
+        using NodeId = uint32_t;
+        using NodeProcessor = function<void(NodeId)>;
 
+        static constexpr NodeId kNoNode = NodeId(-1);
         static constexpr string_view kDefaultRootName = "root";
 
-        
-        uint64_t tree_size_ = 0;
-        shared_ptr<TreeNode> root_;
 
+        // имена нод одного контейнера, каждое хранится один раз;
+        // ноды ссылаются на имя по его номеру в таблице, так что имена сравниваются как числа
+        struct NameTable
+        {
+            using NameId = uint32_t;
+
+            static constexpr NameId kNoName = NameId(-1);
+
+
+            // ключи unordered_map не переезжают при росте, поэтому names_ ссылается прямо на них
+            unordered_map<string, NameId> index_;
+            vector<const string*> names_;
 
+
+            NameTable() = default;
+            NameTable(const NameTable&) = delete;
+            NameTable& operator=(const NameTable&) = delete;
+
+            NameId Intern(const string& name);
+
+            NameId Find(const string& name) const;
+
+            const string& Get(NameId id) const;
+
+            size_t Size() const;
+
+            void Clear();
+
+            uint64_t CalcSize() const;
+
+            void Write(BinaryWriter& writer) const;
+
+            bool Read(BinaryReader& reader);
+        };
+
+        using NameId = NameTable::NameId;
+
+        
+        // то, что есть у каждого файла, - лежит прямо в ноде
         struct FileNodeInfo
         {
-            string name_;
             uint64_t first_chunk_ = kInvalidPos;
             uint64_t content_size_ = 0;
+            vector<FileExtent> extents_;
         };
-        
+
+        // редкие сведения о файле лежат в extras_ по номеру ноды, чтобы не раздувать каждую ноду
+        struct FileExtraInfo
+        {
+            FileStripe stripe_;
+            // содержимое маленького файла, пока у него нет экстентов
+            string inline_data_;
+
+            bool Empty() const;
+        };
+
+        // копия всех сведений о файле, с которой он открывается вне блокировки дерева
+        struct FileSnapshot : FileNodeInfo, FileExtraInfo
+        {
+        };
+
         struct DirectoryNodeInfo
         {
-            string name_;
-            uint64_t subnodes_amount_ = 0;
-            vector<shared_ptr<TreeNode>> subnodes_;
+            // отсортированы по номеру имени, а при равных именах папка идет раньше файла
+            vector<NodeId> subnodes_;
+            // пока папка не загружена, здесь лежат смещения ее нод в образе дерева
+            vector<uint64_t> unloaded_;
         };
 
         struct TreeNode 
@@ -102,28 +239,28 @@ public:
             static constexpr uint16_t kFile = 1;
 
 
-            uint16_t type_;
-            FileNodeInfo file_;
-            DirectoryNodeInfo dir_;
+            NameId name_ = NameTable::kNoName;
+            NodeId parent_ = kNoNode;
+            std::variant<FileNodeInfo, DirectoryNodeInfo> info_;
 
 
-            TreeNode(uint16_t type = kFile);
+            TreeNode(NameId name = NameTable::kNoName, uint16_t type = kFile, NodeId parent = kNoNode);
 
-            TreeNode(const string& name, uint16_t type = kFile);
+            uint16_t Type() const;
 
             bool IsFile() const;
 
             bool IsDirectory() const;
 
-            const std::string& Name() const;
+            NameId Name() const;
 
-            uint64_t CalcSize() const; 
+            FileNodeInfo& FileInfo();
+            const FileNodeInfo& FileInfo() const;
 
-            bool AppendSubnode(shared_ptr<TreeNode>&& sub);
+            DirectoryNodeInfo& DirInfo();
+            const DirectoryNodeInfo& DirInfo() const;
 
-            shared_ptr<TreeNode> GetSubnodeByName(const string& name, uint16_t type = kFile) const;
-
-            bool Has(const string& name, uint16_t type = kFile) const;
+            uint64_t CalcSize() const; 
 
             void Print(ostream& os) const;
             
@@ -131,118 +268,895 @@ public:
 
         };
 
+        // нод столько же, сколько файлов и папок, и каждая должна уместиться в кэш-линию;
+        // редкие поля - в extras_, а не здесь
+        static_assert(sizeof(TreeNode) <= 64);
+
+
+        uint64_t tree_size_ = 0;
+        NodeId root_ = kNoNode;
+        vector<TreeNode> nodes_;
+        unordered_map<NodeId, FileExtraInfo> extras_;
+        NameTable names_;
+        // образ дерева с диска, из которого папки дочитываются при первом обращении
+        string image_;
+
+
+        TreeNode& Node(NodeId id);
+        const TreeNode& Node(NodeId id) const;
 
-        void WriteFileNode(shared_ptr<TreeNode>& node, fstream& stream);
+        const string& NodeName(NodeId id) const;
 
-        void WriteDirectoryNode(shared_ptr<TreeNode>& node, fstream& stream);
+        // у файла без записи в extras_ - пустые сведения
+        const FileExtraInfo& Extra(NodeId id) const;
 
-        uint64_t WriteNode(shared_ptr<TreeNode>& node, fstream& stream);
+        // пустые сведения запись из extras_ убирают
+        void SetExtra(NodeId id, FileExtraInfo extra);
 
-        void Write(fstream& stream);
+        void GetSnapshot(NodeId id, FileSnapshot& snapshot) const;
+
+        NodeId NewNode(NameId name, uint16_t type, NodeId parent);
+
+
+        void WriteFileNode(NodeId node, BinaryWriter& writer);
+
+        void WriteDirectoryNode(NodeId node, BinaryWriter& writer);
+
+        uint64_t WriteNode(NodeId node, BinaryWriter& writer);
+
+        void Write(BinaryWriter& writer);
    
-        void InitializeEmptyTree(fstream& stream);
+        void InitializeEmptyTree();
+
+
+        void ReadDirectoryNode(NodeId node, BinaryReader& reader);
 
+        void ReadFileNode(NodeId node, BinaryReader& reader);
 
-        void ReadDirectoryNode(shared_ptr<TreeNode>& node, fstream& stream);
+        // читает одну ноду; у папки читаются только смещения ее нод
+        NodeId ReadNode(BinaryReader& reader, NodeId parent);
 
-        void ReadFileNode(shared_ptr<TreeNode>& node, fstream& stream);
+        // сразу читается только корень, остальное - по мере обращения
+        bool Read(string image);
 
-        shared_ptr<TreeNode> ReadNode(fstream& stream);
+        bool LoadDirectory(NodeId dir);
 
-        bool Read(fstream& stream);
+        void LoadAll();
 
+        // пройдет ли поиск пути без дочитывания папок
+        bool IsLoaded(const string& path_str, uint16_t type=TreeNode::kFile) const;
 
-        void PrintNode(ostream& os, const shared_ptr<TreeNode>& node, const std::string& path="") const;
+
+        void PrintNode(ostream& os, NodeId node, const std::string& path="") const;
 
         void Print(ostream& os) const;
 
         friend ostream& operator<<(ostream& os, const FileTree& tree);
 
 
-        shared_ptr<TreeNode> GetNode(const string& path_str, uint16_t type=TreeNode::kFile, bool create_missing_dirs=false);
+        NodeId GetSubnodeByName(NodeId dir, NameId name, uint16_t type = TreeNode::kFile) const;
+
+        // добавить в папку новую ноду; если такая уже есть, вернуть ее
+        NodeId AppendSubnode(NodeId dir, NameId name, uint16_t type = TreeNode::kFile);
+
+        NodeId GetNode(const string& path_str, uint16_t type=TreeNode::kFile, bool create_missing_dirs=false);
 
         bool HasPath(const string& path_str, uint16_t type=TreeNode::kFile);
         
         bool AddFile(const string& path_str, uint64_t first_chunk = kInvalidPos);
 
-        void Search(shared_ptr<TreeNode> node, const function<shared_ptr<TreeNode>(shared_ptr<TreeNode>&)>& searcher);
+        // убрать файл из папки; нода остается в массиве, чтобы номера остальных не сдвинулись
+        bool RemoveFile(const string& path_str);
 
-        void DFS(shared_ptr<TreeNode> node, const NodeProcessor& processor);
-        void DFS(shared_ptr<TreeNode> node, const ConstNodeProcessor& processor) const;
+        // незагруженные папки обходятся без своих нод
+        void DFS(NodeId node, const NodeProcessor& processor) const;
 
         uint64_t CalcSize() const;
+    };
+
+    struct JournalRecord
+    {
+        static constexpr uint16_t kAddFile = 1;
+        static constexpr uint16_t kUpdateFile = 2;
+        static constexpr uint16_t kRemoveFile = 3;
+
+        uint16_t type_ = kAddFile;
+        uint64_t first_chunk_ = kInvalidPos;
+        uint64_t content_size_ = 0;
+        string path_;
+        vector<FileExtent> extents_;
+        FileStripe stripe_;
+        string inline_data_;
+
+        void Write(BinaryWriter& writer) const;
+
+        bool Read(BinaryReader& reader);
+
+        bool Apply(FileTree& tree) const;
+    };
+
+    // счетчики разложены по шардам: поток пишет в свой шард (своя кэш-линия, без гонок с другими потоками),
+    // а при чтении шарды суммируются
+    template <size_t Count>
+    struct ShardedCounters
+    {
+        static constexpr size_t kShards = 16;
+
+        struct alignas(64) Shard
+        {
+            atomic<uint64_t> values_[Count];
+
+            Shard()
+            {
+                for (auto& value : values_)
+                    value.store(0, std::memory_order_relaxed);
+            }
+        };
+
+        Shard shards_[kShards];
+
+
+        void Add(size_t counter, uint64_t value = 1)
+        {
+            shards_[ThreadShard() % kShards].values_[counter].fetch_add(value, std::memory_order_relaxed);
+        }
+
+        std::array<uint64_t, Count> Sum() const
+        {
+            std::array<uint64_t, Count> sum{};
+            for (const auto& shard : shards_)
+                for (size_t i = 0; i < Count; i++)
+                    sum[i] += shard.values_[i].load(std::memory_order_relaxed);
+            return sum;
+        }
+    };
+
+    // номер шарда текущего потока, раздается по кругу при первом обращении
+    static size_t ThreadShard();
 
-        bool IsGrown() const;
+    struct Metrics
+    {
+        enum StorageCounter : size_t
+        {
+            kHeaderReads,
+            // обращения к самому контейнеру (мимо кэша чанков), каждое - отдельное позиционирование
+            kDeviceReads,
+            kDeviceWrites,
+            kDeviceBytesRead,
+            kDeviceBytesWritten,
+            kChunksAllocated,
+            kChunksFreed,
+            // полные чанки, которые при записи нашлись в индексе и не записывались
+            kChunksDeduped,
+            kTreeWrites,
+            // дочитывания папок под эксклюзивной блокировкой
+            kPathLoads,
+            kJournalAppends,
+            kLockWaits,
+            kTreeLockWaitNs,
+            kAllocLockWaitNs,
+            kDedupLockWaitNs,
+            kStorageCounters,
+        };
 
-        void ShiftFileChunks(uint64_t bytes);
+        enum Operation : size_t
+        {
+            kOpen,
+            kCreate,
+            kRead,
+            kWrite,
+            kClose,
+            kSeek,
+            kTell,
+            kReadAt,
+            kWriteAt,
+            kWriteV,
+            kWriteBatch,
+            kOperations,
+        };
+
+        enum OperationField : size_t
+        {
+            kCalls,
+            kBytes,
+            kNanos,
+            kOperationFields,
+        };
 
-        // void Foreach(uint16_t type, const NodeProcessor& processor);
+        using StorageCounters = ShardedCounters<kStorageCounters>;
+        using OperationCounters = ShardedCounters<kOperations * kOperationFields>;
+
+        static const char* StorageCounterName(size_t counter);
+
+        static const char* OperationName(size_t operation);
+
+        struct Snapshot
+        {
+            struct Storage
+            {
+                string filename_;
+                std::array<uint64_t, kStorageCounters> values_{};
+            };
+
+            vector<Storage> storages_;
+            std::array<uint64_t, kOperations * kOperationFields> operations_{};
+
+            uint64_t Operation(size_t operation, size_t field) const;
+
+            // разница с более ранним снимком; контейнеры сопоставляются по имени файла
+            Snapshot Diff(const Snapshot& before) const;
+
+            void PrintText(ostream& os) const;
+
+            void PrintJson(ostream& os) const;
+        };
+    };
+
+    // все реализации должны допускать параллельные ReadAt/WriteAt из разных потоков
+    struct StorageBackend
+    {
+        virtual ~StorageBackend() = default;
+
+        static unique_ptr<StorageBackend> Open(const string& filename, StorageBackendType type);
+
+        virtual bool Valid() const = 0;
+
+        // возвращают, сколько байт реально удалось прочитать/записать
+        virtual size_t ReadAt(uint64_t pos, char* buf, size_t len) = 0;
+
+        virtual size_t WriteAt(uint64_t pos, const char* buf, size_t len) = 0;
+
+        virtual uint64_t Size() = 0;
+
+        virtual void Flush() = 0;
+    };
+
+    struct StreamBackend : StorageBackend
+    {
+        // у fstream одна позиция на всех, поэтому обращения к нему идут по очереди
+        fstream stream_;
+        mutex m_;
+
+        StreamBackend(const string& filename);
+
+        bool Valid() const override;
+        size_t ReadAt(uint64_t pos, char* buf, size_t len) override;
+        size_t WriteAt(uint64_t pos, const char* buf, size_t len) override;
+        uint64_t Size() override;
+        void Flush() override;
+    };
+
+    struct MmapBackend : StorageBackend
+    {
+        int fd_ = -1;
+        char* data_ = nullptr;
+        // size_ - реальный размер контейнера, capacity_ - размер отображения;
+        // файл растягивается (ftruncate) до capacity_ и обрезается обратно при закрытии
+        atomic<uint64_t> size_ = 0;
+        uint64_t capacity_ = 0;
+        // разделяемо - доступ к отображению, эксклюзивно - переотображение
+        shared_mutex m_;
+
+        MmapBackend(const string& filename);
+
+        ~MmapBackend() override;
+
+        bool Reserve(uint64_t capacity);
+
+        bool Valid() const override;
+        size_t ReadAt(uint64_t pos, char* buf, size_t len) override;
+        size_t WriteAt(uint64_t pos, const char* buf, size_t len) override;
+        uint64_t Size() override;
+        void Flush() override;
+    };
+
+    struct PosixBackend : StorageBackend
+    {
+        int fd_ = -1;
+
+        PosixBackend(const string& filename);
+
+        ~PosixBackend() override;
+
+        bool Valid() const override;
+        size_t ReadAt(uint64_t pos, char* buf, size_t len) override;
+        size_t WriteAt(uint64_t pos, const char* buf, size_t len) override;
+        uint64_t Size() override;
+        void Flush() override;
+    };
+
+    struct ChunkCache
+    {
+        struct Key
+        {
+            uint64_t storage_ = 0;
+            uint64_t chunk_ = 0;
+
+            bool operator==(const Key& other) const;
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& key) const;
+        };
+
+        struct Page
+        {
+            Key key_;
+            // сколько байт чанка реально есть в контейнере (последний чанк может быть неполным)
+            size_t size_ = 0;
+            vector<char> data_;
+        };
+
+        struct Stats
+        {
+            uint64_t hits_ = 0;
+            uint64_t misses_ = 0;
+            uint64_t evictions_ = 0;
+            size_t pages_ = 0;
+            size_t capacity_ = 0;
+        };
+
+        // кэш разбит на шарды со своими блокировками, чтобы потоки,
+        // читающие разные чанки, не ждали друг друга
+        struct Shard
+        {
+            // страницы от самой свежей к самой старой
+            list<Page> lru_;
+            unordered_map<Key, list<Page>::iterator, KeyHash> index_;
+            // растет при каждой записи, чтобы не положить в кэш страницу, прочитанную до записи
+            uint64_t version_ = 0;
+            mutex m_;
+        };
+
+        static constexpr size_t kShards = 16;
+        // страницы кэша - участки контейнера фиксированного размера, независимо от размера его чанков
+        static constexpr size_t kPageSize = kDefaultChunkSize;
+
+        Shard shards_[kShards];
+        atomic<size_t> capacity_ = 0;
+        atomic<uint64_t> hits_ = 0;
+        atomic<uint64_t> misses_ = 0;
+        atomic<uint64_t> evictions_ = 0;
+
+        ChunkCache(size_t capacity = kDefaultChunkCachePages);
+
+        static uint64_t NextStorageId();
+
+        bool Enabled() const;
+
+        void SetCapacity(size_t capacity);
+
+        // скопировать [offset, offset + len) чанка из кэша, при промахе страница
+        // подгружается через load вне блокировки; возвращает, сколько байт удалось прочитать
+        size_t Read(const Key& key, size_t offset, char* buf, size_t len,
+                    const function<size_t(char*)>& load);
+
+        // запись уже ушла в контейнер, страница (если есть) обновляется
+        void Update(const Key& key, size_t offset, const char* buf, size_t len);
+
+        void Invalidate(uint64_t storage);
+
+        Stats GetStats();
+
+        Shard& ShardOf(const Key& key);
+
+        size_t ShardCapacity() const;
+
+        void Evict(Shard& shard, size_t limit);
+    };
+
+    struct CachedBackend : StorageBackend
+    {
+        // крупные последовательные чтения идут мимо кэша, чтобы не вытеснять из него горячие чанки
+        static constexpr size_t kBypassSize = 4 * ChunkCache::kPageSize;
+
+        unique_ptr<StorageBackend> backend_;
+        shared_ptr<ChunkCache> cache_;
+        uint64_t id_ = ChunkCache::NextStorageId();
+
+        CachedBackend(unique_ptr<StorageBackend>&& backend, shared_ptr<ChunkCache> cache);
+
+        ~CachedBackend() override;
+
+        bool Valid() const override;
+        size_t ReadAt(uint64_t pos, char* buf, size_t len) override;
+        size_t WriteAt(uint64_t pos, const char* buf, size_t len) override;
+        uint64_t Size() override;
+        void Flush() override;
+    };
+
+    // считает обращения к контейнеру; стоит под кэшем, так что видит только реальный ввод-вывод
+    struct MeteredBackend : StorageBackend
+    {
+        unique_ptr<StorageBackend> backend_;
+        Metrics::StorageCounters& metrics_;
+
+        MeteredBackend(unique_ptr<StorageBackend>&& backend, Metrics::StorageCounters& metrics);
+
+        bool Valid() const override;
+        size_t ReadAt(uint64_t pos, char* buf, size_t len) override;
+        size_t WriteAt(uint64_t pos, const char* buf, size_t len) override;
+        uint64_t Size() override;
+        void Flush() override;
+    };
+
+    // размеры чанка контейнера. Горячие пути записаны шаблоном по раскладке и собираются
+    // отдельно для частых размеров (FixedChunkLayout<N>, арифметика сворачивается в константы),
+    // а остальные размеры идут через ChunkLayout с размером из заголовка
+    struct ChunkLayout
+    {
+        size_t size_ = kDefaultChunkSize;
+
+        size_t ChunkSize() const { return size_; }
+        size_t PayloadSize() const { return size_ - kChunkHeaderSize; }
+        uint64_t ToBytes(uint64_t chunks) const { return chunks * size_; }
+        uint64_t ToChunks(uint64_t bytes) const { return (bytes + size_ - 1) / size_; }
+        uint64_t Index(uint64_t pos) const { return pos / size_; }
+    };
+
+    template <size_t Size>
+    struct FixedChunkLayout
+    {
+        static_assert(Size >= kMinChunkSize && Size <= kMaxChunkSize && (Size & (Size - 1)) == 0);
+
+        static constexpr size_t ChunkSize() { return Size; }
+        static constexpr size_t PayloadSize() { return Size - kChunkHeaderSize; }
+        static constexpr uint64_t ToBytes(uint64_t chunks) { return chunks * Size; }
+        static constexpr uint64_t ToChunks(uint64_t bytes) { return (bytes + Size - 1) / Size; }
+        static constexpr uint64_t Index(uint64_t pos) { return pos / Size; }
+    };
+
+    // сжатие контента чанка: LZ77 в духе LZ4 - последовательности из токена (длины литералов
+    // и совпадения по 4 бита, с продолжением байтами 255), литералов и 16-битного смещения совпадения
+    struct ChunkCodec
+    {
+        static constexpr size_t kMinMatch = 4;
+        static constexpr size_t kMaxOffset = 0xFFFF;
+        static constexpr size_t kHashBits = 12;
+
+        // размер сжатых данных или 0, если они не влезли в capacity
+        static size_t Compress(const char* src, size_t len, char* dst, size_t capacity);
+
+        // распаковать ровно out_len байт; false, если данные испорчены
+        static bool Decompress(const char* src, size_t len, char* dst, size_t out_len);
     };
 
     struct ChunkHeader
     {
-        bool filled_ = true;
+        static constexpr uint8_t kCompressed = 1;
+
+        // в контейнере с дедупликацией чанк может принадлежать нескольким файлам
+        uint32_t refs_ = 1;
         bool last_ = true;
         uint64_t used_ = 0;
         uint64_t next_ = kInvalidPos;
+        uint8_t flags_ = 0;
+        // сколько байт занимает сжатый контент; used_ при этом - его размер после распаковки
+        uint32_t stored_ = 0;
+        uint64_t hash_ = 0;
 
-        uint64_t last_read_pos_;
+        uint64_t last_read_pos_ = kInvalidPos;
 
-        void Read(fstream& stream, uint64_t pos = kInvalidPos);
+        bool Read(StorageBackend& backend, uint64_t pos);
     
-        void Write(fstream& stream, uint64_t pos = kInvalidPos);
+        void Write(StorageBackend& backend, uint64_t pos) const;
+
+        // сериализовать заголовок в буфер из kChunkHeaderSize байт, чтобы писать его вместе с данными
+        char* Store(char* p) const;
 
         bool HasNext() const;
 
-        void GoNext(fstream& stream);
+        bool GoNext(StorageBackend& backend);
+
+        bool Compressed() const;
+    };
+
+    struct ChunkBitmap
+    {
+        static constexpr size_t kWordBits = 64;
+
+        // бит = занят ли чанк
+        vector<uint64_t> words_;
+        // бит = заполнено ли соответствующее слово words_ целиком,
+        // чтобы поиск свободного чанка не просматривал занятые слова
+        vector<uint64_t> summary_;
+        size_t size_ = 0;
+        size_t used_ = 0;
+
+        void Resize(size_t chunks);
+
+        void Clear();
+
+        size_t Size() const;
+
+        size_t FreeCount() const;
+
+        bool Test(size_t idx) const;
+
+        void Set(size_t idx);
+
+        void Reset(size_t idx);
+
+        // первый свободный чанк или Size(), если свободных нет
+        size_t FindFree() const;
+
+        size_t NextFree(size_t idx) const;
+
+        size_t NextUsed(size_t idx) const;
+
+        // сколько свободных чанков подряд (не больше want) начинается с idx;
+        // за концом карты место не ограничено
+        size_t FreeRunAt(size_t idx, size_t want) const;
+
+        // первый участок хотя бы из want свободных чанков, иначе хвост карты
+        size_t FindFreeRun(size_t want) const;
+
+        uint8_t Byte(size_t byte_idx) const;
+
+        void SetByte(size_t byte_idx, uint8_t byte);
+    };
+
+    // то, что выбирается при создании контейнера и дальше не меняется
+    struct StorageFormat
+    {
+        size_t chunk_size_ = kDefaultChunkSize;
+        bool compress_ = false;
+        bool dedup_ = false;
+    };
+
+    // полные чанки файлов по отпечатку содержимого и ссылки на общие чанки;
+    // в памяти, собирается по заголовкам чанков при открытии контейнера
+    struct DedupIndex
+    {
+        unordered_map<uint64_t, uint64_t> by_hash_;
+        unordered_map<uint64_t, uint64_t> by_pos_;
+        // только чанки с несколькими владельцами, у остальных ссылка одна
+        unordered_map<uint64_t, uint32_t> refs_;
+
+        // 0 не бывает - им в заголовке помечен чанк без отпечатка
+        static uint64_t Fingerprint(const char* data, size_t len);
+
+        // kInvalidPos, если чанка с таким отпечатком нет
+        uint64_t Find(uint64_t hash) const;
+
+        // отпечаток, уже указывающий на другой чанк, не перебивается
+        void Insert(uint64_t hash, uint64_t pos);
+
+        void Erase(uint64_t pos);
+
+        uint32_t Refs(uint64_t pos) const;
+
+        void SetRefs(uint64_t pos, uint32_t refs);
+
+        uint32_t AddRef(uint64_t pos);
+
+        // сколько ссылок осталось; при 0 чанк убирается из индекса и его можно освобождать
+        uint32_t Release(uint64_t pos);
+
+        void Clear();
+    };
+
+    struct StorageHeader
+    {
+        static constexpr uint64_t kChunkSizePos = sizeof(uint32_t) + sizeof(uint16_t);
+        static constexpr uint64_t kCompressPos = kChunkSizePos + sizeof(uint32_t);
+        static constexpr uint64_t kDedupPos = kCompressPos + sizeof(bool);
+        static constexpr uint64_t kTreeChunkPos = kDedupPos + sizeof(bool);
+        static constexpr uint64_t kTreeSizePos = kTreeChunkPos + sizeof(uint64_t);
+        static constexpr uint64_t kLogChunkPos = kTreeSizePos + sizeof(uint64_t);
+        static constexpr uint64_t kLogSizePos = kLogChunkPos + sizeof(uint64_t);
+        static constexpr uint64_t kChunksAmountPos = kLogSizePos + sizeof(uint64_t);
+        static constexpr uint64_t kBitmapChunkPos = kChunksAmountPos + sizeof(uint64_t);
+        static constexpr uint64_t kBitmapSizePos = kBitmapChunkPos + sizeof(uint64_t);
+        static constexpr uint64_t kHeaderSize = kBitmapSizePos + sizeof(uint64_t);
+
+        uint32_t magic_ = kStorageMagic;
+        uint16_t version_ = kStorageVersion;
+        uint32_t chunk_size_ = kDefaultChunkSize;
+        bool compress_ = false;
+        bool dedup_ = false;
+        uint64_t tree_chunk_ = kInvalidPos;
+        uint64_t tree_size_ = 0;
+        uint64_t log_chunk_ = kInvalidPos;
+        uint64_t log_size_ = 0;
+        uint64_t chunks_amount_ = 0;
+        uint64_t bitmap_chunk_ = kInvalidPos;
+        uint64_t bitmap_size_ = 0;
+
+        bool Read(StorageBackend& backend);
+
+        void Write(StorageBackend& backend);
+
+        // указатели на дерево и журнал пишутся одной записью,
+        // так что контрольная точка переключается целиком
+        void WriteRefs(StorageBackend& backend);
+
+        // количество чанков и цепочка битовой карты, тоже одной записью
+        void WriteBitmapRefs(StorageBackend& backend);
     };
 
     struct StorageFile 
     {
         string filename_;
-        fstream stream_;
-        mutex m_;
+        // объявлены раньше backend_, который на них ссылается
+        mutable Metrics::StorageCounters metrics_;
+        unique_ptr<StorageBackend> backend_;
+        // разделяемо - поиск по дереву, эксклюзивно - изменение дерева и журнала
+        shared_mutex tree_m_;
+        // битовая карта и ее копия в цепочке bitmap_chunks_
+        mutable mutex alloc_m_;
+        // индекс дедупликации и ссылки в заголовках общих чанков
+        mutable mutex dedup_m_;
         // size_t free_chunks_ = 0;
         // size_t filled_chunks_ = 0;
         // size_t total_chunks_ = 0;
         FileTree tree_;
+        // растет при каждой перезагрузке дерева, чтобы кэш путей отбросил старые ноды
+        uint64_t generation_ = 0;
+        StorageHeader header_;
+        ChunkLayout layout_;
+        // встроенный файл не больше полезной части чанка этого контейнера
+        size_t inline_cap_ = 0;
+        ChunkBitmap free_chunks_;
+        // данными файлов контейнер растет не дальше этого размера; под alloc_m_
+        size_t size_limit_ = kDefaultStorageFileSizeLimit;
+        DedupIndex dedup_;
+        // индекс заполняется при первой записи в контейнер, под dedup_m_
+        bool dedup_loaded_ = false;
+        vector<uint64_t> tree_chunks_;
+        vector<uint64_t> log_chunks_;
+        vector<uint64_t> bitmap_chunks_;
+        // контейнер с нашей сигнатурой не прочитался; он не открывается и не перезаписывается
+        bool damaged_ = false;
+
+        // format - каким создать новый контейнер, у существующего он берется из заголовка
+        StorageFile(string filename, StorageBackendType backend_type, shared_ptr<ChunkCache> cache,
+                    const StorageFormat& format);
+
+
+        void SetupTree(const StorageFormat& format);
 
-        // header (tree, size, files amount, dirs amount)
+        bool Valid();
 
-        StorageFile(string filename);
+        // блокировки с учетом времени ожидания в metrics_
+        shared_lock<shared_mutex> LockTreeShared();
+        unique_lock<shared_mutex> LockTree();
+        unique_lock<mutex> LockAlloc() const;
+        unique_lock<mutex> LockDedup() const;
 
-        StorageFile(StorageFile&& other);
+        struct Usage
+        {
+            size_t chunks_ = 0;
+            size_t used_chunks_ = 0;
+            // свободные чанки внутри файла плюс те, на которые он еще может вырасти до лимита
+            size_t free_chunks_ = 0;
+            size_t fill_percent_ = 0;
+        };
 
-        void SetupTree();
+        Usage GetUsage(size_t size_limit) const;
 
-        bool Valid();
+        bool HasSpace(size_t size_limit) const;
+
+        void SetSizeLimit(size_t size_limit);
+
+        bool HasDirectory(const string& path);
+
+        // восстановить карту по заголовкам чанков, если ее цепочка не читается
+        void RebuildBitmap();
+
+        bool ReadBitmap();
+
+        // дописать в цепочку карты байты чанков [idx, idx + count), при нужде удлинив ее; под alloc_m_
+        void WriteBitmap(size_t idx, size_t count = 1);
+
+        // под dedup_m_; повторный вызов ничего не делает
+        void LoadDedupIndex();
+
+        // найти свободный чанк и сразу пометить его занятым
+        uint64_t AllocateChunk();
+
+        // занять до want чанков подряд, по возможности начиная с preferred
+        // (чтобы продолжить последний экстент файла); в length - сколько заняли.
+        // За size_limit_ файл не растет: места нет - length = 0 и kInvalidPos
+        uint64_t AllocateRun(uint64_t preferred, size_t want, size_t& length);
+
+        void MarkChunk(uint64_t pos, bool used);
+
+        // with_tail - байты за size допустимы и отбрасываются (недописанный хвост журнала)
+        bool ReadChain(uint64_t first_chunk, uint64_t size, string& data, vector<uint64_t>& chunks, bool with_tail = false);
 
-        uint64_t FindFreeChunk();
+        void WriteChain(const string& data, vector<uint64_t>& chunks);
 
-        void ShiftChunks(size_t from, size_t shift = 1);
+        void AppendChain(const string& data, vector<uint64_t>& chunks, uint64_t size);
 
-        bool CreateEmptyFile(const string& path);
+        void FreeChain(vector<uint64_t>& chunks);
+
+        // пометить чанк свободным в заголовке и в битовой карте
+        void FreeChunk(uint64_t pos);
+
+        // под LockDedup: снять ссылку файла с чанка, вернуть, сколько осталось
+        uint32_t DropRef(uint64_t pos);
+
+        void WriteChunkRefs(uint64_t pos, uint32_t refs);
+
+        bool ReadTree();
+
+        // дочитать папки на пути, чтобы дальше искать по нему под разделяемой блокировкой
+        void LoadPath(const string& path, uint16_t type);
+
+        // контрольная точка: дерево целиком в новую цепочку, журнал очищается
+        void WriteTree();
+
+        bool ReplayJournal();
+
+        void AppendJournal(const JournalRecord& record);
+
+        bool CreateEmptyFile(const string& path, const FileStripe& stripe = FileStripe());
+
+        // откат CreateEmptyFile: удаляется только файл, в который ничего не записано
+        bool RemoveEmptyFile(const string& path);
 
         bool HasFile(const string& path);
 
+        FileTree::NodeId FindFile(const string& path);
+
+        // копия сведений о файле; номер ноды действителен, пока не сменилось поколение дерева
+        bool GetFileInfo(FileTree::NodeId node, FileTree::FileSnapshot& info);
+
         bool ClearFile(const string& path);
 
-        bool ForeachChunk(const string& path, const function<void(ChunkHeader, fstream&)>& processor);
+        // записать в журнал новый размер файла после записи
+        bool CommitFile(const string& path, uint64_t content_size, const vector<FileExtent>& extents,
+                        const string& inline_data = string());
+
+        // вернуть чанки, занятые писателем про запас и не понадобившиеся
+        void TrimFile(File& file);
+
+        // вызвать func с раскладкой чанков контейнера: для частых размеров - с FixedChunkLayout
+        template <typename Func>
+        auto WithLayout(Func&& func);
+
+        // позиция чанка idx файла и сколько чанков (не больше max) лежат подряд за ним;
+        // индекс чанков файла строится из экстентов при первом обращении
+        template <typename Layout>
+        static size_t ChunkRun(File& file, uint64_t idx, size_t max, uint64_t& pos, Layout layout);
+
+        size_t ReadFile(File& file, char* buf, size_t len);
+
+        template <typename Layout>
+        size_t ReadFile(File& file, char* buf, size_t len, Layout layout);
+
+        // в сжимающем контейнере чанки читаются по одному: заголовок, потом stored_ байт;
+        // последний распакованный чанк остается в File
+        template <typename Layout>
+        size_t ReadPacked(File& file, char* buf, size_t len, Layout layout);
+
+        // логическое содержимое чанка (used_ байт), распакованное, если чанк сжат
+        bool ReadChunk(uint64_t pos, size_t payload, string& data);
+
+        // записать чанк целиком, сжав его, если так выходит короче; buf - рабочий буфер
+        bool WriteChunk(uint64_t pos, const string& data, string& buf, uint64_t hash = 0);
+
+        size_t WriteFile(File& file, const char* buf, size_t len);
+
+        // записать буферы подряд; данные склеиваются в целые чанки вместе с заголовками,
+        // а у файла без экстентов, пока он не перерос порог, - в inline_data_
+        size_t WriteFile(File& file, const iovec* iov, size_t count);
+
+        template <typename Layout>
+        size_t WriteFile(File& file, const iovec* iov, size_t count, Layout layout);
+
+        // в сжимающем и дедуплицирующем контейнерах каждый затронутый чанк переписывается целиком
+        template <typename Layout>
+        size_t WritePacked(File& file, const iovec* iov, size_t count, Layout layout);
+
+        // записать idx-й чанк файла (pos - его место или kInvalidPos, если его еще нет):
+        // такой же полный чанк берется из индекса, общий - не меняется, а заменяется копией
+        template <typename Layout>
+        bool WriteDeduped(File& file, uint64_t idx, uint64_t pos, const string& data, string& buf, size_t want, Layout layout);
+
+        // поставить чанк pos idx-м в файл (или дописать, если idx - следующий за последним)
+        template <typename Layout>
+        void ReplaceChunk(File& file, uint64_t idx, uint64_t pos, Layout layout);
+
+        // занять под запись want чанков (и запас по размеру файла), по возможности
+        // подряд за последним экстентом; false - контейнер дошел до лимита
+        template <typename Layout>
+        bool GrowFile(File& file, size_t want, Layout layout);
+
+        // перенести встроенное содержимое файла в чанки
+        bool SpillInline(File& file);
+
+        // дописать буферы с текущей позиции: на диск уходят только целые чанки,
+        // а недописанный хвост копится в pending_ до следующей записи или FlushFile
+        size_t AppendFile(File& file, const iovec* iov, size_t count);
+
+        template <typename Layout>
+        size_t AppendFile(File& file, const iovec* iov, size_t count, Layout layout);
+
+        bool FlushFile(File& file);
+
+        bool ForeachChunk(const string& path, const function<void(const ChunkHeader&, StorageBackend&)>& processor);
+    };
+
+
+    struct CachedPath
+    {
+        size_t storage_ = 0;
+        uint64_t generation_ = 0;
+        FileTree::NodeId node_ = FileTree::kNoNode;
     };
 
 
     struct FileDescriptor
     {
-        shared_ptr<FileTree::TreeNode> node_;
+        FileTree::NodeId node_ = FileTree::kNoNode;
+        size_t storage_ = 0;
+        size_t opened_ = 0;
         FileMode mode_ = FileMode::kInvalid;
+        // полосы файла по порядку, если он разбит между контейнерами
+        vector<CachedPath> stripes_;
 
-        File* GetFile(FileMode mode);
+        // info - сведения о файле, stripes - о его полосах в порядке stripes_
+        File* GetFile(FileMode mode, const FileTree::FileSnapshot& info, const vector<FileTree::FileSnapshot>& stripes);
     };
 
 
-    static size_t ToChunks(size_t bytes);
+    // пул потоков для асинхронных операций; у каждого контейнера своя очередь,
+    // и ее в каждый момент разбирает не больше одного потока, так что операции
+    // с одним File выполняются в порядке отправки
+    struct IoPool
+    {
+        using Callback = function<void(size_t)>;
+
+        struct Request
+        {
+            File* file_ = nullptr;
+            bool write_ = false;
+            char* read_buf_ = nullptr;
+            const char* write_buf_ = nullptr;
+            size_t len_ = 0;
+            Callback done_;
+            // фоновая задача вместо чтения или записи, file_ не нужен
+            function<void()> task_;
+        };
+
+        struct Queue
+        {
+            deque<Request> requests_;
+            bool busy_ = false;
+        };
+
+        // очередь фоновых задач: номер, которого нет ни у одного контейнера
+        static constexpr size_t kTaskQueue = size_t(-1);
+
+        VFS& vfs_;
+        vector<thread> threads_;
+        map<size_t, Queue> queues_;
+        // контейнеры, у которых есть операции и которые сейчас никто не разбирает
+        deque<size_t> ready_;
+        bool stop_ = false;
+        mutex m_;
+        condition_variable cv_;
+
+        IoPool(VFS& vfs, size_t threads);
+
+        ~IoPool();
+
+        void Submit(size_t storage, Request&& request);
+
+        // вызван ли код из потока пула: такие операции не должны ждать других операций пула
+        static bool InWorker();
+
+        void Worker();
+
+        // выполнить пачку операций одного контейнера: операции группируются по File
+        // с сохранением порядка внутри файла, подряд идущие записи склеиваются в один WriteV
+        void Run(vector<Request>& batch);
+    };
+
 
-    static size_t ToBytes(size_t chunks);
   
 public:
     static VFS *Instance();
@@ -254,30 +1168,143 @@ public:
     void operator=(const VFS&) = delete;
 
     bool AddStorageFile(const string& filename);
+    bool AddStorageFile(const string& filename, StorageBackendType backend_type);
+    void SetStorageBackend(StorageBackendType backend_type);
+    void SetChunkCacheSize(size_t pages);
+    ChunkCache::Stats GetChunkCacheStats();
     void SetStorageFileFilenamePrefix(const string& prefix);
     bool SetStorageFileSizeLimit(size_t size);
+    // размер чанка, сжатие и дедупликация - для контейнеров, которые будут созданы дальше; уже существующие их не меняют
+    bool SetChunkSize(size_t size);
+    void SetCompression(bool enabled);
+    void SetDedup(bool enabled);
+    // степень двойки в пределах [kMinChunkSize, kMaxChunkSize]
+    static bool ValidChunkSize(size_t size);
+    void SetIoThreads(size_t threads);
+    // новые файлы раскладываются кусками по unit байт на count контейнеров по кругу,
+    // count <= 1 выключает разбиение
+    void SetStriping(size_t count, size_t unit = kDefaultStripeUnit);
+    void SetPlacementPolicy(PlacementPolicy policy);
+    // файлы до bytes байт хранятся в дереве; 0 - всегда в чанках;
+    // порог урезается до полезной части чанка контейнера, в который попал файл
+    void SetInlineThreshold(size_t bytes);
+
+    struct StorageStats
+    {
+        string filename_;
+        StorageFile::Usage usage_;
+    };
+
+    vector<StorageStats> GetStorageStats();
+
+    Metrics::Snapshot GetMetrics();
+
+    // асинхронные Read/Write выполняются в пуле потоков; буфер и File должны
+    // жить до завершения операции, Close - только после завершения всех операций с файлом
+    future<size_t> ReadAsync(File* f, char* buff, size_t len);
+    future<size_t> WriteAsync(File* f, const char* buff, size_t len);
+    void ReadAsync(File* f, char* buff, size_t len, IoPool::Callback done);
+    void WriteAsync(File* f, const char* buff, size_t len, IoPool::Callback done);
 
     void test();
 
     void test2();
 
+    // проверки с утверждениями на временных контейнерах; false, если какая-то не прошла
+    static bool SelfTest();
+
+    // доступ проверок к внутренностям, определен в selftest.cpp
+    struct SelfTestAccess;
+
 
 	virtual File *Open( const char *name ) override;
 	virtual File *Create( const char *name ) override;
 	virtual size_t Read( File *f, char *buff, size_t len ) override;
 	virtual size_t Write( File *f, char *buff, size_t len ) override;
 	virtual void Close( File *f ) override;
+	virtual bool Seek( File *f, uint64_t offset ) override;
+	virtual uint64_t Tell( File *f ) override;
+	virtual size_t ReadAt( File *f, uint64_t offset, char *buff, size_t len ) override;
+	virtual size_t WriteAt( File *f, uint64_t offset, const char *buff, size_t len ) override;
+	virtual size_t WriteV( File *f, const iovec *iov, size_t count ) override;
+	virtual size_t WriteBatch( File *const *files, const iovec *iov, size_t count ) override;
 
 
 private:
-    bool CreateNewStorageFile();
+    // storage - куда записать номер нового контейнера
+    bool CreateNewStorageFile(size_t* storage = nullptr);
+
+    // то же под уже взятой create_storage_m_
+    bool CreateStorageFileUnlocked(size_t* storage);
+
+    bool OpenStorageFile(const string& filename, StorageBackendType backend_type, size_t* storage = nullptr);
+
+    StorageFile& GetStorageFile(size_t storage);
+
+    size_t StorageCount();
+
+    static string NormalizePath(const string& path);
+
+    bool LookupPath(const string& path, CachedPath& found);
+
+    void CachePath(const string& path, size_t storage);
+
+    // path - путь создаваемого файла, по нему выбирается контейнер с его папкой
+    StorageFile* PickStorageFile(size_t& storage, const string& path = string());
+
+    // поставить в пул создание нового контейнера заранее, если все существующие почти заполнены
+    void EnsureSpareStorage();
+
+    // создать запасной контейнер, если все почти заполнены; выполняется в пуле
+    void CreateSpareStorage();
+
+    void SubmitIo(File* f, IoPool::Request&& request);
+
+    // фоновая работа VFS в отдельной очереди пула
+    void SubmitTask(function<void()> task);
+
+    File* OpenDescriptor(FileDescriptor& descriptor, const string& path, FileMode mode);
+
+    bool FindStripes(const string& path, const CachedPath& found, vector<CachedPath>& stripes);
+
+    // создать файл или очистить существующий; путь уже занят описателем в opened_files_
+    bool CreateOrTruncate(const string& path, size_t stripe_count, CachedPath& found, vector<CachedPath>& stripes);
+
+    bool CreateStriped(const string& path);
+
+    size_t ReadStriped(File& f, char* buff, size_t len);
+
+    size_t WriteStriped(File& f, const iovec* iov, size_t count);
 
 
 private:
-    vector<StorageFile> storage_files_;
+    // контейнер строится и размечается вне m_, в список попадает уже готовым;
+    // ссылку на него можно держать без блокировки VFS
+    deque<unique_ptr<StorageFile>> storage_files_;
     string storage_filename_prefix_ = string(kDefaultStorageFilePrefix);
     size_t storage_file_size_limit_ = kDefaultStorageFileSizeLimit;
+    StorageFormat storage_format_;
+    StorageBackendType storage_backend_ = StorageBackendType::kPosix;
+    shared_ptr<ChunkCache> chunk_cache_ = make_shared<ChunkCache>();
     map<string, FileDescriptor> opened_files_;
+    unordered_map<string, CachedPath> path_cache_;
+    // защищает opened_files_, path_cache_ и состав storage_files_; ввод-вывод контейнеров
+    // под ней не идет, его сериализуют блокировки самих контейнеров
+    shared_mutex m_;
+    // выбор имени и создание нового контейнера
+    mutex create_storage_m_;
+    // создание запасного контейнера уже стоит в пуле
+    atomic<bool> spare_pending_{ false };
+    PlacementPolicy placement_policy_ = PlacementPolicy::kLeastFull;
+    size_t stripe_count_ = 1;
+    size_t stripe_unit_ = kDefaultStripeUnit;
+    size_t inline_threshold_ = kDefaultInlineThreshold;
+    size_t io_threads_ = kDefaultIoThreads;
+    Metrics::OperationCounters op_metrics_;
+    mutex io_pool_m_;
+    // создается при первой асинхронной операции; объявлен последним, чтобы
+    // потоки остановились раньше, чем разрушатся контейнеры
+    unique_ptr<IoPool> io_pool_;
 
 };
 
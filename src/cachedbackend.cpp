@@ -0,0 +1,89 @@
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using CachedBackend = VFS::CachedBackend;
+using ChunkCache = VFS::ChunkCache;
+
+
+CachedBackend::CachedBackend(unique_ptr<StorageBackend>&& backend, shared_ptr<ChunkCache> cache)
+    : backend_(std::move(backend)), cache_(std::move(cache))
+{
+
+}
+
+
+CachedBackend::~CachedBackend()
+{
+    cache_->Invalidate(id_);
+}
+
+
+bool CachedBackend::Valid() const
+{
+    return backend_->Valid();
+}
+
+
+size_t CachedBackend::ReadAt(uint64_t pos, char* buf, size_t len)
+{
+    if (!cache_->Enabled() || len > kBypassSize)
+        return backend_->ReadAt(pos, buf, len);
+
+    size_t read = 0;
+
+    while (read < len)
+    {
+        uint64_t page_pos = pos / ChunkCache::kPageSize * ChunkCache::kPageSize;
+        size_t offset = pos - page_pos;
+        size_t part = std::min(ChunkCache::kPageSize - offset, len - read);
+
+        size_t got = cache_->Read(ChunkCache::Key{ id_, page_pos }, offset, buf + read, part, [&](char* page)
+        {
+            return backend_->ReadAt(page_pos, page, ChunkCache::kPageSize);
+        });
+
+        read += got;
+        pos += got;
+
+        if (got != part)
+            break;
+    }
+
+    return read;
+}
+
+
+size_t CachedBackend::WriteAt(uint64_t pos, const char* buf, size_t len)
+{
+    size_t written = backend_->WriteAt(pos, buf, len);
+
+    for (size_t done = 0; done < written;)
+    {
+        uint64_t page_pos = (pos + done) / ChunkCache::kPageSize * ChunkCache::kPageSize;
+        size_t offset = pos + done - page_pos;
+        size_t part = std::min(ChunkCache::kPageSize - offset, written - done);
+
+        cache_->Update(ChunkCache::Key{ id_, page_pos }, offset, buf + done, part);
+        done += part;
+    }
+
+    return written;
+}
+
+
+uint64_t CachedBackend::Size()
+{
+    return backend_->Size();
+}
+
+
+void CachedBackend::Flush()
+{
+    backend_->Flush();
+}
+
+
+}
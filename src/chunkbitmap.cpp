@@ -0,0 +1,192 @@
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using ChunkBitmap = VFS::ChunkBitmap;
+
+
+static constexpr uint64_t kFullWord = ~uint64_t(0);
+
+
+void ChunkBitmap::Resize(size_t chunks)
+{
+    size_t words = chunks / kWordBits + (chunks % kWordBits == 0 ? 0 : 1);
+
+    // биты за пределами size_ всегда нулевые, поэтому слово, попавшее
+    // в summary_ как заполненное, целиком лежит внутри карты
+    for (size_t i = chunks; i < size_; i++)
+        Reset(i);
+
+    words_.resize(words, 0);
+    summary_.resize(words / kWordBits + 1, 0);
+    size_ = chunks;
+}
+
+
+void ChunkBitmap::Clear()
+{
+    words_.clear();
+    summary_.clear();
+    size_ = 0;
+    used_ = 0;
+}
+
+
+size_t ChunkBitmap::Size() const
+{
+    return size_;
+}
+
+
+size_t ChunkBitmap::FreeCount() const
+{
+    return size_ - used_;
+}
+
+
+bool ChunkBitmap::Test(size_t idx) const
+{
+    if (idx >= size_)
+        return false;
+    return (words_[idx / kWordBits] >> (idx % kWordBits)) & 1;
+}
+
+
+void ChunkBitmap::Set(size_t idx)
+{
+    if (idx >= size_ || Test(idx))
+        return;
+
+    size_t w = idx / kWordBits;
+    words_[w] |= uint64_t(1) << (idx % kWordBits);
+    ++used_;
+
+    if (words_[w] == kFullWord)
+        summary_[w / kWordBits] |= uint64_t(1) << (w % kWordBits);
+}
+
+
+void ChunkBitmap::Reset(size_t idx)
+{
+    if (idx >= size_ || !Test(idx))
+        return;
+
+    size_t w = idx / kWordBits;
+    words_[w] &= ~(uint64_t(1) << (idx % kWordBits));
+    summary_[w / kWordBits] &= ~(uint64_t(1) << (w % kWordBits));
+    --used_;
+}
+
+
+size_t ChunkBitmap::FindFree() const
+{
+    for (size_t s = 0; s < summary_.size(); s++)
+    {
+        if (summary_[s] == kFullWord)
+            continue;
+
+        size_t w = s * kWordBits + __builtin_ctzll(~summary_[s]);
+        if (w >= words_.size())
+            break;
+
+        size_t idx = w * kWordBits + __builtin_ctzll(~words_[w]);
+        return idx < size_ ? idx : size_;
+    }
+
+    return size_;
+}
+
+
+size_t ChunkBitmap::NextFree(size_t idx) const
+{
+    if (idx >= size_)
+        return idx;
+
+    size_t w = idx / kWordBits;
+    uint64_t word = ~words_[w] & (kFullWord << (idx % kWordBits));
+
+    while (word == 0)
+    {
+        if (++w >= words_.size())
+            return size_;
+        word = ~words_[w];
+    }
+
+    size_t res = w * kWordBits + __builtin_ctzll(word);
+    return res < size_ ? res : size_;
+}
+
+
+size_t ChunkBitmap::NextUsed(size_t idx) const
+{
+    if (idx >= size_)
+        return size_;
+
+    size_t w = idx / kWordBits;
+    uint64_t word = words_[w] & (kFullWord << (idx % kWordBits));
+
+    while (word == 0)
+    {
+        if (++w >= words_.size())
+            return size_;
+        word = words_[w];
+    }
+
+    // биты за пределами size_ нулевые, так что найденный бит внутри карты
+    return w * kWordBits + __builtin_ctzll(word);
+}
+
+
+size_t ChunkBitmap::FreeRunAt(size_t idx, size_t want) const
+{
+    if (Test(idx))
+        return 0;
+
+    size_t used = NextUsed(idx);
+    if (used >= size_)
+        return want;
+
+    return std::min(used - idx, want);
+}
+
+
+size_t ChunkBitmap::FindFreeRun(size_t want) const
+{
+    size_t idx = FindFree();
+
+    while (idx < size_)
+    {
+        if (FreeRunAt(idx, want) == want)
+            return idx;
+        idx = NextFree(NextUsed(idx));
+    }
+
+    return size_;
+}
+
+
+uint8_t ChunkBitmap::Byte(size_t byte_idx) const
+{
+    size_t w = byte_idx / sizeof(uint64_t);
+    if (w >= words_.size())
+        return 0;
+    return uint8_t(words_[w] >> ((byte_idx % sizeof(uint64_t)) * 8));
+}
+
+
+void ChunkBitmap::SetByte(size_t byte_idx, uint8_t byte)
+{
+    for (size_t bit = 0; bit < 8; bit++)
+    {
+        size_t idx = byte_idx * 8 + bit;
+        if ((byte >> bit) & 1)
+            Set(idx);
+        else
+            Reset(idx);
+    }
+}
+
+
+}
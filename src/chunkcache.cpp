@@ -0,0 +1,192 @@
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using ChunkCache = VFS::ChunkCache;
+
+
+bool ChunkCache::Key::operator==(const Key& other) const
+{
+    return storage_ == other.storage_ && chunk_ == other.chunk_;
+}
+
+
+size_t ChunkCache::KeyHash::operator()(const Key& key) const
+{
+    return std::hash<uint64_t>()(key.chunk_ ^ (key.storage_ * 0x9E3779B97F4A7C15ull));
+}
+
+
+ChunkCache::ChunkCache(size_t capacity): capacity_(capacity)
+{
+
+}
+
+
+uint64_t ChunkCache::NextStorageId()
+{
+    static atomic<uint64_t> next_id = 0;
+    return ++next_id;
+}
+
+
+bool ChunkCache::Enabled() const
+{
+    return capacity_ != 0;
+}
+
+
+ChunkCache::Shard& ChunkCache::ShardOf(const Key& key)
+{
+    return shards_[(key.chunk_ / kPageSize + key.storage_) % kShards];
+}
+
+
+size_t ChunkCache::ShardCapacity() const
+{
+    return capacity_ / kShards + (capacity_ % kShards == 0 ? 0 : 1);
+}
+
+
+void ChunkCache::Evict(Shard& shard, size_t limit)
+{
+    while (shard.lru_.size() > limit)
+    {
+        shard.index_.erase(shard.lru_.back().key_);
+        shard.lru_.pop_back();
+        ++evictions_;
+    }
+}
+
+
+void ChunkCache::SetCapacity(size_t capacity)
+{
+    capacity_ = capacity;
+
+    for (auto& shard : shards_)
+    {
+        lock_guard lock(shard.m_);
+        Evict(shard, ShardCapacity());
+    }
+}
+
+
+static size_t copy_page(const ChunkCache::Page& page, size_t offset, char* buf, size_t len)
+{
+    if (offset >= page.size_)
+        return 0;
+
+    len = std::min(len, page.size_ - offset);
+    std::copy(page.data_.data() + offset, page.data_.data() + offset + len, buf);
+    return len;
+}
+
+
+size_t ChunkCache::Read(const Key& key, size_t offset, char* buf, size_t len,
+                        const function<size_t(char*)>& load)
+{
+    auto& shard = ShardOf(key);
+    uint64_t version = 0;
+
+    {
+        lock_guard lock(shard.m_);
+
+        auto it = shard.index_.find(key);
+        if (it != shard.index_.end())
+        {
+            ++hits_;
+            shard.lru_.splice(shard.lru_.begin(), shard.lru_, it->second);
+            return copy_page(*it->second, offset, buf, len);
+        }
+
+        version = shard.version_;
+    }
+
+    ++misses_;
+
+    Page page;
+    page.key_ = key;
+    page.data_.resize(kPageSize);
+    page.size_ = load(page.data_.data());
+
+    size_t read = copy_page(page, offset, buf, len);
+
+    lock_guard lock(shard.m_);
+
+    size_t limit = ShardCapacity();
+    if (limit == 0 || shard.version_ != version || shard.index_.count(key))
+        return read;
+
+    Evict(shard, limit - 1);
+    shard.lru_.push_front(std::move(page));
+    shard.index_.emplace(key, shard.lru_.begin());
+
+    return read;
+}
+
+
+void ChunkCache::Update(const Key& key, size_t offset, const char* buf, size_t len)
+{
+    auto& shard = ShardOf(key);
+    lock_guard lock(shard.m_);
+
+    ++shard.version_;
+
+    auto it = shard.index_.find(key);
+    if (it == shard.index_.end())
+        return;
+
+    auto& page = *it->second;
+
+    // дыра между концом страницы и записью в контейнере читается нулями
+    if (offset > page.size_)
+        std::fill(page.data_.begin() + page.size_, page.data_.begin() + offset, 0);
+
+    std::copy(buf, buf + len, page.data_.begin() + offset);
+    page.size_ = std::max(page.size_, offset + len);
+}
+
+
+void ChunkCache::Invalidate(uint64_t storage)
+{
+    for (auto& shard : shards_)
+    {
+        lock_guard lock(shard.m_);
+
+        for (auto it = shard.lru_.begin(); it != shard.lru_.end();)
+        {
+            if (it->key_.storage_ == storage)
+            {
+                shard.index_.erase(it->key_);
+                it = shard.lru_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+}
+
+
+ChunkCache::Stats ChunkCache::GetStats()
+{
+    Stats stats;
+    stats.hits_ = hits_;
+    stats.misses_ = misses_;
+    stats.evictions_ = evictions_;
+    stats.capacity_ = capacity_;
+
+    for (auto& shard : shards_)
+    {
+        lock_guard lock(shard.m_);
+        stats.pages_ += shard.lru_.size();
+    }
+
+    return stats;
+}
+
+
+}
@@ -0,0 +1,183 @@
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using ChunkCodec = VFS::ChunkCodec;
+
+
+static uint32_t read_u32(const char* p)
+{
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+
+static size_t hash_u32(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - ChunkCodec::kHashBits);
+}
+
+
+// длина сверх того, что влезло в полубайт токена: байты 255 и последний меньше 255
+static char* store_length(size_t len, char* op, const char* end)
+{
+    for (; len >= 255; len -= 255)
+    {
+        if (op == end)
+            return nullptr;
+        *op++ = char(255);
+    }
+
+    if (op == end)
+        return nullptr;
+    *op++ = char(len);
+    return op;
+}
+
+
+static bool load_length(size_t& len, const char*& ip, const char* end)
+{
+    uint8_t byte = 255;
+    while (byte == 255)
+    {
+        if (ip == end)
+            return false;
+        byte = uint8_t(*ip++);
+        len += byte;
+    }
+
+    return true;
+}
+
+
+// последовательность: токен, литералы и, если match != 0, смещение и длина совпадения
+static char* store_sequence(const char* literals, size_t literal_len, size_t match, size_t offset, char* op, const char* end)
+{
+    if (op == end)
+        return nullptr;
+
+    size_t match_code = match == 0 ? 0 : match - ChunkCodec::kMinMatch;
+    char* token = op++;
+    *token = char((std::min<size_t>(literal_len, 15) << 4) | std::min<size_t>(match_code, 15));
+
+    if (literal_len >= 15 && !(op = store_length(literal_len - 15, op, end)))
+        return nullptr;
+
+    if (size_t(end - op) < literal_len)
+        return nullptr;
+    std::memcpy(op, literals, literal_len);
+    op += literal_len;
+
+    if (match == 0)
+        return op;
+
+    if (end - op < 2)
+        return nullptr;
+    *op++ = char(offset & 0xFF);
+    *op++ = char(offset >> 8);
+
+    if (match_code >= 15 && !(op = store_length(match_code - 15, op, end)))
+        return nullptr;
+
+    return op;
+}
+
+
+size_t ChunkCodec::Compress(const char* src, size_t len, char* dst, size_t capacity)
+{
+    // позиции последних четверок байт по их хешу; совпадение хеша проверяется сравнением.
+    // Таблица своя у потока и обнуляется на каждый вызов, чтобы не выделять ее заново
+    static thread_local std::array<uint32_t, size_t(1) << kHashBits> table;
+    table.fill(0);
+
+    char* op = dst;
+    const char* end = dst + capacity;
+    size_t anchor = 0;
+    size_t i = 0;
+
+    while (i + kMinMatch <= len)
+    {
+        uint32_t value = read_u32(src + i);
+        uint32_t& slot = table[hash_u32(value)];
+        size_t candidate = slot;
+        slot = uint32_t(i);
+
+        if (candidate >= i || i - candidate > kMaxOffset || read_u32(src + candidate) != value)
+        {
+            ++i;
+            continue;
+        }
+
+        size_t match = kMinMatch;
+        while (i + match < len && src[candidate + match] == src[i + match])
+            ++match;
+
+        if (!(op = store_sequence(src + anchor, i - anchor, match, i - candidate, op, end)))
+            return 0;
+
+        i += match;
+        anchor = i;
+    }
+
+    // последняя последовательность - только литералы, ей поток и заканчивается
+    if (!(op = store_sequence(src + anchor, len - anchor, 0, 0, op, end)))
+        return 0;
+
+    return op - dst;
+}
+
+
+bool ChunkCodec::Decompress(const char* src, size_t len, char* dst, size_t out_len)
+{
+    const char* ip = src;
+    const char* end = src + len;
+    size_t out = 0;
+
+    while (ip < end)
+    {
+        uint8_t token = uint8_t(*ip++);
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !load_length(literal_len, ip, end))
+            return false;
+
+        if (size_t(end - ip) < literal_len || out_len - out < literal_len)
+            return false;
+        std::memcpy(dst + out, ip, literal_len);
+        ip += literal_len;
+        out += literal_len;
+
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return false;
+        size_t offset = uint8_t(ip[0]) | (size_t(uint8_t(ip[1])) << 8);
+        ip += 2;
+
+        size_t match = token & 0x0F;
+        if (match == 15 && !load_length(match, ip, end))
+            return false;
+        match += kMinMatch;
+
+        if (offset == 0 || offset > out || out_len - out < match)
+            return false;
+
+        // совпадение может перекрываться с тем, что само же сейчас пишет
+        const char* from = dst + out - offset;
+        if (offset >= match)
+            std::memcpy(dst + out, from, match);
+        else
+            for (size_t k = 0; k < match; k++)
+                dst[out + k] = from[k];
+        out += match;
+    }
+
+    return out == out_len;
+}
+
+
+}
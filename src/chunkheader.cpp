@@ -5,39 +5,47 @@ namespace TestTask
 {
 
 using ChunkHeader = VFS::ChunkHeader;
+using StorageBackend = VFS::StorageBackend;
 
 
-void ChunkHeader::Read(fstream& stream, uint64_t pos)
+bool ChunkHeader::Read(StorageBackend& backend, uint64_t pos)
 {
-    auto prev_pos = stream.tellg();
-    if (pos != kInvalidPos)
-        stream.seekg(pos);
-    
-    last_read_pos_ = stream.tellg();
+    char buf[kChunkHeaderSize];
+    last_read_pos_ = pos;
 
-    read_integer(filled_, stream);
-    read_integer(last_, stream);
-    read_integer(used_, stream);
-    read_integer(next_, stream);
-    
-    if (pos != kInvalidPos)
-        stream.seekg(prev_pos);
+    if (backend.ReadAt(pos, buf, sizeof(buf)) != sizeof(buf))
+        return false;
+
+    const char* p = buf;
+    p = load_integer(refs_, p);
+    p = load_integer(last_, p);
+    p = load_integer(used_, p);
+    p = load_integer(next_, p);
+    p = load_integer(flags_, p);
+    p = load_integer(stored_, p);
+    load_integer(hash_, p);
+
+    return true;
 }
 
 
-void ChunkHeader::Write(fstream& stream, uint64_t pos)
+void ChunkHeader::Write(StorageBackend& backend, uint64_t pos) const
 {
-    auto prev_pos = stream.tellp();
-    if (pos != kInvalidPos)
-        stream.seekp(pos);
-
-    write_integer(filled_, stream);
-    write_integer(last_, stream);
-    write_integer(used_, stream);
-    write_integer(next_, stream);
-    
-    if (pos != kInvalidPos)
-        stream.seekp(prev_pos);
+    char buf[kChunkHeaderSize];
+    Store(buf);
+    backend.WriteAt(pos, buf, sizeof(buf));
+}
+
+
+char* ChunkHeader::Store(char* p) const
+{
+    p = store_integer(refs_, p);
+    p = store_integer(last_, p);
+    p = store_integer(used_, p);
+    p = store_integer(next_, p);
+    p = store_integer(flags_, p);
+    p = store_integer(stored_, p);
+    return store_integer(hash_, p);
 }
 
 
@@ -47,13 +55,18 @@ bool ChunkHeader::HasNext() const
 }
 
 
-void ChunkHeader::GoNext(fstream& stream)
+bool ChunkHeader::GoNext(StorageBackend& backend)
 {
     if (!HasNext())
-        return;
+        return false;
     
-    stream.seekg(next_);
-    Read(stream);
+    return Read(backend, next_);
+}
+
+
+bool ChunkHeader::Compressed() const
+{
+    return (flags_ & kCompressed) != 0;
 }
 
 
@@ -0,0 +1,103 @@
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using DedupIndex = VFS::DedupIndex;
+
+
+uint64_t DedupIndex::Fingerprint(const char* data, size_t len)
+{
+    // совпадение отпечатков еще не значит совпадения содержимого, оно сверяется при записи
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ len;
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+
+    for (; i < len; i++)
+        hash = (hash ^ uint8_t(data[i])) * 0x100000001B3ull;
+
+    hash ^= hash >> 29;
+    return hash == 0 ? 1 : hash;
+}
+
+
+uint64_t DedupIndex::Find(uint64_t hash) const
+{
+    auto it = by_hash_.find(hash);
+    return it == by_hash_.end() ? kInvalidPos : it->second;
+}
+
+
+void DedupIndex::Insert(uint64_t hash, uint64_t pos)
+{
+    Erase(pos);
+
+    if (by_hash_.emplace(hash, pos).second)
+        by_pos_[pos] = hash;
+}
+
+
+void DedupIndex::Erase(uint64_t pos)
+{
+    auto it = by_pos_.find(pos);
+    if (it == by_pos_.end())
+        return;
+
+    by_hash_.erase(it->second);
+    by_pos_.erase(it);
+}
+
+
+uint32_t DedupIndex::Refs(uint64_t pos) const
+{
+    auto it = refs_.find(pos);
+    return it == refs_.end() ? 1 : it->second;
+}
+
+
+void DedupIndex::SetRefs(uint64_t pos, uint32_t refs)
+{
+    if (refs > 1)
+        refs_[pos] = refs;
+    else
+        refs_.erase(pos);
+}
+
+
+uint32_t DedupIndex::AddRef(uint64_t pos)
+{
+    uint32_t refs = Refs(pos) + 1;
+    refs_[pos] = refs;
+    return refs;
+}
+
+
+uint32_t DedupIndex::Release(uint64_t pos)
+{
+    uint32_t refs = Refs(pos) - 1;
+    SetRefs(pos, refs);
+
+    if (refs == 0)
+        Erase(pos);
+
+    return refs;
+}
+
+
+void DedupIndex::Clear()
+{
+    by_hash_.clear();
+    by_pos_.clear();
+    refs_.clear();
+}
+
+
+}
@@ -5,21 +5,45 @@ namespace TestTask
 {
 
 using FileTree = VFS::FileTree;
-using TreeNode = FileTree::TreeNode;
 using FileDescriptor = VFS::FileDescriptor;
 
 
-File* FileDescriptor::GetFile(FileMode mode)
+File* FileDescriptor::GetFile(FileMode mode, const FileTree::FileSnapshot& info, const vector<FileTree::FileSnapshot>& stripes)
 {
     if (mode_ == FileMode::kInvalid)
         mode_ = mode;
     else if (mode_ != FileMode::kReadOnly || mode != FileMode::kReadOnly)
         return nullptr;    
 
+    ++opened_;
+
     File* file = new File();
     file->mode_ = mode;
-    file->first_chunk_ = node_->file_.first_chunk_;
-    file->last_chunk_= file->first_chunk_;
+    file->first_chunk_ = info.first_chunk_;
+    file->size_ = info.content_size_;
+    file->extents_ = info.extents_;
+    file->inline_data_ = info.inline_data_;
+
+    for (size_t i = 0; i < stripes.size() && i < stripes_.size(); i++)
+    {
+        File* part = new File();
+        part->mode_ = mode;
+        part->first_chunk_ = stripes[i].first_chunk_;
+        part->size_ = stripes[i].content_size_;
+        part->extents_ = stripes[i].extents_;
+        part->inline_data_ = stripes[i].inline_data_;
+        part->storage_ = stripes_[i].storage_;
+
+        file->stripes_.push_back(part);
+        file->stripe_unit_ = stripes[i].stripe_.unit_;
+    }
+
+    if (!file->stripes_.empty())
+    {
+        file->size_ = 0;
+        for (auto* part : file->stripes_)
+            file->size_ += part->size_;
+    }
 
     return file;
 }
@@ -8,17 +8,66 @@ using FileTree = VFS::FileTree;
 using TreeNode = FileTree::TreeNode;
 
 
-void FileTree::Search(shared_ptr<TreeNode> node, const std::function<shared_ptr<TreeNode>(shared_ptr<TreeNode>&)>& searcher)
+TreeNode& FileTree::Node(NodeId id)
 {
-    auto next = searcher(node);
-    if (next)
-        Search(next, searcher);
+    return nodes_[id];
 }
 
 
-void FileTree::DFS(shared_ptr<TreeNode> node, const NodeProcessor& processor)
+const TreeNode& FileTree::Node(NodeId id) const
 {
-    std::stack<shared_ptr<TreeNode>> stack;
+    return nodes_[id];
+}
+
+
+const string& FileTree::NodeName(NodeId id) const
+{
+    return names_.Get(Node(id).Name());
+}
+
+
+bool FileTree::FileExtraInfo::Empty() const
+{
+    return stripe_.count_ <= 1 && stripe_.index_ == 0 && stripe_.unit_ == 0 && inline_data_.empty();
+}
+
+
+const FileTree::FileExtraInfo& FileTree::Extra(NodeId id) const
+{
+    static const FileExtraInfo kNoExtra;
+
+    auto it = extras_.find(id);
+    return it == extras_.end() ? kNoExtra : it->second;
+}
+
+
+void FileTree::SetExtra(NodeId id, FileExtraInfo extra)
+{
+    if (extra.Empty())
+        extras_.erase(id);
+    else
+        extras_[id] = std::move(extra);
+}
+
+
+void FileTree::GetSnapshot(NodeId id, FileSnapshot& snapshot) const
+{
+    static_cast<FileNodeInfo&>(snapshot) = Node(id).FileInfo();
+    static_cast<FileExtraInfo&>(snapshot) = Extra(id);
+}
+
+
+FileTree::NodeId FileTree::NewNode(NameId name, uint16_t type, NodeId parent)
+{
+    // после добавления ноды ссылки на другие ноды могут стать недействительными, номера - нет
+    nodes_.emplace_back(name, type, parent);
+    return NodeId(nodes_.size() - 1);
+}
+
+
+void FileTree::DFS(NodeId node, const NodeProcessor& processor) const
+{
+    std::stack<NodeId> stack;
 
     stack.push(node);
 
@@ -28,148 +77,192 @@ void FileTree::DFS(shared_ptr<TreeNode> node, const NodeProcessor& processor)
         stack.pop();
         processor(current);
 
-        if (current->IsDirectory())
-            for (auto& next : current->dir_.subnodes_)
+        if (Node(current).IsDirectory())
+            for (auto next : Node(current).DirInfo().subnodes_)
                 stack.push(next);
     }
 }
 
 
-void FileTree::DFS(shared_ptr<TreeNode> node, const ConstNodeProcessor& processor) const
+uint64_t FileTree::CalcSize() const
 {
-    auto* not_const_this = const_cast<FileTree*>(this);
+    uint64_t total_size = sizeof(tree_size_) + names_.CalcSize();
 
-    auto processor_wrapper = [&processor](const shared_ptr<TreeNode>& node)
-    {
-        auto const_node = std::const_pointer_cast<const TreeNode>(node);
-        processor(const_node);
-    };
+    DFS(root_, [this, &total_size](NodeId node)
+    {   
+        total_size += Node(node).CalcSize();
+        if (Node(node).IsFile())
+            total_size += Extra(node).inline_data_.size();
+    });
 
-    not_const_this->DFS(node, processor_wrapper);
+    return total_size;
 }
 
 
-uint64_t FileTree::CalcSize() const
+static bool subnode_less(const TreeNode& a, const TreeNode& b)
 {
-    uint64_t total_size = sizeof(tree_size_);
+    return a.Name() < b.Name() || (a.Name() == b.Name() && a.Type() < b.Type());
+}
 
-    DFS(root_, [&total_size](const shared_ptr<const TreeNode>& node)
-    {   
-        total_size += node->CalcSize();
+
+FileTree::NodeId FileTree::GetSubnodeByName(NodeId dir, NameId name, uint16_t type) const
+{
+    if (dir == kNoNode || name == NameTable::kNoName || !Node(dir).IsDirectory())
+        return kNoNode;
+
+    auto& subnodes = Node(dir).DirInfo().subnodes_;
+    auto it = std::lower_bound(subnodes.begin(), subnodes.end(), name, [this, type](NodeId sub, NameId key)
+    {
+        auto& node = Node(sub);
+        return node.Name() < key || (node.Name() == key && node.Type() < type);
     });
 
-    return total_size;
+    if (it == subnodes.end() || Node(*it).Name() != name || Node(*it).Type() != type)
+        return kNoNode;
+
+    return *it;
 }
 
 
-void FileTree::ShiftFileChunks(uint64_t bytes)
+FileTree::NodeId FileTree::AppendSubnode(NodeId dir, NameId name, uint16_t type)
 {
-    DFS(root_, [bytes](const shared_ptr<TreeNode>& node)
+    if (dir == kNoNode || !Node(dir).IsDirectory())
+        return kNoNode;
+
+    LoadDirectory(dir);
+
+    auto existing = GetSubnodeByName(dir, name, type);
+    if (existing != kNoNode)
+        return existing;
+
+    auto sub = NewNode(name, type, dir);
+
+    auto& subnodes = Node(dir).DirInfo().subnodes_;
+    auto it = std::lower_bound(subnodes.begin(), subnodes.end(), sub, [this](NodeId a, NodeId b)
     {
-        if (node->IsFile())
-            node->file_.first_chunk_ += bytes;
+        return subnode_less(Node(a), Node(b));
     });
+    subnodes.insert(it, sub);
+
+    return sub;
 }
 
 
 bool FileTree::AddFile(const string& path_str, uint64_t first_chunk)
 {
     auto path = split_string(path_str, kPathDelimeter);
-    bool actually_added = false;
 
     if (path.size() == 0)
-        return actually_added;
+        return false;
 
     string filename = std::move(*(path.end() - 1));
     path.pop_back();
     
     auto path_without_file = path_str.substr(0, path_str.rfind(kPathDelimeter));
 
-    cout << "[FileTree::AddFile] begin find parent dir" << endl;
-    auto file_parent_dir = GetNode(path_without_file, TreeNode::kDirectory, true);
-    cout << "[FileTree::AddFile] found parent dir " << *file_parent_dir << endl;
+    auto file_parent_dir = path.empty() ? root_ : GetNode(path_without_file, TreeNode::kDirectory, true);
+    if (file_parent_dir == kNoNode)
+        return false;
+    VFS_TRACE(kTree, kDebug, "AddFile " << path_str << " parent " << Node(file_parent_dir));
+
+    auto name = names_.Intern(filename);
+    if (GetSubnodeByName(file_parent_dir, name, TreeNode::kFile) != kNoNode)
+        return false;
+
+    auto new_file = AppendSubnode(file_parent_dir, name, TreeNode::kFile);
+    auto& file = Node(new_file).FileInfo();
+    file.first_chunk_ = first_chunk;
+    // новый файл пуст и хранится в дереве, пока в него не запишут больше порога
+    if (first_chunk != kInvalidPos)
+        file.extents_.push_back({first_chunk, 1});
+
+    return true;
+}
 
-    if (!file_parent_dir->Has(filename, TreeNode::kFile))
-    {
-        auto new_file = make_shared<TreeNode>(filename, TreeNode::kFile);
-        new_file->file_.first_chunk_ = first_chunk;
-        file_parent_dir->AppendSubnode(std::move(new_file));
-        actually_added = true;
-    }
 
-    return actually_added;
+bool FileTree::RemoveFile(const string& path_str)
+{
+    auto node = GetNode(path_str, TreeNode::kFile);
+    if (node == kNoNode)
+        return false;
+
+    auto& subnodes = Node(Node(node).parent_).DirInfo().subnodes_;
+    subnodes.erase(std::find(subnodes.begin(), subnodes.end(), node));
+    extras_.erase(node);
+    VFS_TRACE(kTree, kDebug, "RemoveFile " << path_str);
+
+    return true;
 }
 
 
-shared_ptr<TreeNode> FileTree::GetNode(const string& path_str, uint16_t type, bool create_missing_dirs)
+FileTree::NodeId FileTree::GetNode(const string& path_str, uint16_t type, bool create_missing_dirs)
 {
     auto path = split_string(path_str, kPathDelimeter);
 
     if (path.size() == 0)
         return root_;
-    
-    if (path.size() == 1)
-    {
-        if (type == TreeNode::kDirectory && 
-            create_missing_dirs && 
-            !root_->Has(path[0], TreeNode::kDirectory))
-        {
-            root_->AppendSubnode(make_shared<TreeNode>(path[0], TreeNode::kDirectory));
-        }
-
-        return root_->GetSubnodeByName(path[0], type);
-    }
 
     string last = std::move(*(path.end() - 1));
     path.pop_back();
-    
-    size_t path_part = 0;
-    shared_ptr<TreeNode> found;
 
-    Search(root_, [&](shared_ptr<TreeNode>& node)
+    NodeId current = root_;
+
+    // при обычном поиске имена только ищутся в таблице, чтобы не менять ее под разделяемой блокировкой
+    for (auto& part : path)
     {
-        auto next = node->GetSubnodeByName(path[path_part], TreeNode::kDirectory);
-        
-        if (next)
-        {
-            ++path_part;
-            if (path_part != path.size())
-                return next;
-
-            if (next->Has(last, type))
-            {
-                found = next->GetSubnodeByName(last, type);
-                return shared_ptr<TreeNode>{};
-            }
-            
-            if (type == TreeNode::kFile)
-                return shared_ptr<TreeNode>{};
-
-            auto new_dir = make_shared<TreeNode>(last, TreeNode::kDirectory);
-            new_dir->dir_.name_ = last;
-            found = new_dir;
-            next->AppendSubnode(std::move(new_dir));
-
-            return shared_ptr<TreeNode>{};
-        }
-        else if (create_missing_dirs)
+        LoadDirectory(current);
+        auto next = GetSubnodeByName(current, names_.Find(part), TreeNode::kDirectory);
+
+        if (next == kNoNode)
         {
-            auto new_dir = make_shared<TreeNode>(path[path_part], TreeNode::kDirectory);
-            node->AppendSubnode(std::move(new_dir));
-            next = node;
+            if (!create_missing_dirs)
+                return kNoNode;
+            next = AppendSubnode(current, names_.Intern(part), TreeNode::kDirectory);
         }
 
-        return next;
-    });
+        current = next;
+    }
+
+    LoadDirectory(current);
+    auto found = GetSubnodeByName(current, names_.Find(last), type);
+
+    if (found == kNoNode && type == TreeNode::kDirectory && create_missing_dirs)
+        found = AppendSubnode(current, names_.Intern(last), TreeNode::kDirectory);
 
     return found;
 }
 
 
+bool FileTree::IsLoaded(const string& path_str, uint16_t type) const
+{
+    auto path = split_string(path_str, kPathDelimeter);
+
+    if (path.size() == 0)
+        return true;
+
+    NodeId current = root_;
+
+    // тот же обход, что и в GetNode, но без дочитывания
+    for (size_t i = 0; i < path.size(); i++)
+    {
+        if (current == kNoNode)
+            return true;
+
+        if (!Node(current).DirInfo().unloaded_.empty())
+            return false;
+
+        auto part_type = i + 1 == path.size() ? type : TreeNode::kDirectory;
+        current = GetSubnodeByName(current, names_.Find(path[i]), part_type);
+    }
+
+    return true;
+}
+
+
 
 void FileTree::Print(std::ostream& os) const
 {
-    os << "FileTree\n{\nsize=" << tree_size_ << "; root=" << root_.get() << endl;
+    os << "FileTree\n{\nsize=" << tree_size_ << "; nodes=" << nodes_.size() << endl;
     PrintNode(os, root_);
     os << "}" << endl;
 }
@@ -182,50 +275,62 @@ std::ostream& operator<<(std::ostream& os, const FileTree& tree)
 }
 
 
-void FileTree::PrintNode(std::ostream& os, const shared_ptr<TreeNode>& node, const std::string& path) const
+void FileTree::PrintNode(std::ostream& os, NodeId node, const std::string& path) const
 {
-    if (!node)
+    if (node == kNoNode)
     {
         os << path << "null path" << endl;
         return;
     }
 
-    if (node->IsFile())
+    auto& current = Node(node);
+
+    if (current.IsFile())
     {
-        auto& file = node->file_;
-        os << path << file.name_ << "  {" << file.first_chunk_ << "}" << endl;
+        os << path << NodeName(node) << "  {" << current.FileInfo().first_chunk_ << "}" << endl;
     }
     else
     {
-        auto& dir = node->dir_;
-        os << path << dir.name_ << "/" << endl;
+        os << path << NodeName(node) << "/" << endl;
 
-        if (dir.subnodes_amount_ != 0)
+        if (!current.DirInfo().unloaded_.empty())
         {
-            string path_ = path + dir.name_ + "/";
-            for (auto& sub : dir.subnodes_)
-                PrintNode(os, sub, path_);
+            os << path << NodeName(node) << "/...  {not loaded}" << endl;
+            return;
         }
+
+        string path_ = path + NodeName(node) + "/";
+        for (auto sub : current.DirInfo().subnodes_)
+            PrintNode(os, sub, path_);
     }
 }
 
 
 
-bool FileTree::Read(fstream& stream)
+bool FileTree::Read(string image)
 {
-    read_integer(tree_size_, stream);
-    root_ = ReadNode(stream);
-    size_t size_read = stream.tellg();
-    // cout << "read tree size = " << tree_size_ << endl;
+    nodes_.clear();
+    extras_.clear();
+    image_ = std::move(image);
+
+    BinaryReader reader(image_);
+    reader.Read(tree_size_);
+    if (names_.Read(reader))
+        root_ = ReadNode(reader, kNoNode);
+    else
+        root_ = kNoNode;
 
-    bool success = !(size_read != tree_size_ || stream.eof() || !stream.good());
-    cout << "read tree success=" << success << endl;
+    bool success = !(root_ == kNoNode || !Node(root_).IsDirectory() || image_.size() != tree_size_ || !reader.Good());
+    VFS_TRACE(kTree, kInfo, "Read tree success=" << success << " size=" << tree_size_ << " names=" << names_.Size());
 
     if (!success)
     {
-        root_.reset();
+        nodes_.clear();
+        extras_.clear();
+        names_.Clear();
+        image_.clear();
+        root_ = kNoNode;
         tree_size_ = 0;
-        stream.clear();
     }
 
     return success;
@@ -233,180 +338,258 @@ bool FileTree::Read(fstream& stream)
 
 
 
-shared_ptr<TreeNode> FileTree::ReadNode(fstream& stream)
+FileTree::NodeId FileTree::ReadNode(BinaryReader& reader, NodeId parent)
 {
-    if (!stream.good())
-        return {};
+    if (!reader.Good())
+        return kNoNode;
 
-    auto node = make_shared<TreeNode>();
-    read_integer(node->type_, stream);
+    uint16_t type = 0;
+    reader.Read(type);
 
-    cout << "[FileTree::ReadNode] type=" << node->type_ << endl; 
-    // cout << "   stream tellg: " << stream.tellg() << endl;
 
-    if (node->IsDirectory())
-        ReadDirectoryNode(node, stream);
-    else if (node->IsFile())
-        ReadFileNode(node, stream);
+    if (type != TreeNode::kDirectory && type != TreeNode::kFile)
+    {
+        reader.Fail();
+        return kNoNode;
+    }
+
+    auto node = NewNode(NameTable::kNoName, type, parent);
+
+    if (type == TreeNode::kDirectory)
+        ReadDirectoryNode(node, reader);
+    else
+        ReadFileNode(node, reader);
 
     return node;
 }
 
 
 
-void FileTree::ReadFileNode(shared_ptr<TreeNode>& node, fstream& stream)
+void FileTree::ReadFileNode(NodeId node, BinaryReader& reader)
 {
-    if (!stream.good())
+    if (!reader.Good())
         return;
 
-    auto& file = node->file_;
+    auto& current = Node(node);
+    auto& file = current.FileInfo();
 
-    cout << "[FileTree::ReadFileNode] begin read tellg=" << stream.tellg() << endl;
+    reader.Read(file.first_chunk_);
+    reader.Read(file.content_size_);
+    reader.Read(current.name_);
+    if (current.name_ >= names_.Size())
+        reader.Fail();
+
+    uint64_t extents_amount = 0;
+    reader.Read(extents_amount);
+
+    file.extents_.clear();
+    for (uint64_t i = 0; i < extents_amount && reader.Good(); i++)
+    {
+        FileExtent extent;
+        reader.Read(extent.start_);
+        reader.Read(extent.length_);
+        file.extents_.push_back(extent);
+    }
 
-    // cout << "read file first chunk pos=" << stream.tellg() << endl;
-    read_integer(file.first_chunk_, stream);
-    // cout << "read file content size pos=" << stream.tellg() << endl;
-    read_integer(file.content_size_, stream);
-    // cout << "read file name pos=" << stream.tellg() << endl;
-    read_string(file.name_, stream);
-    // cout << "end read file name pos=" << stream.tellg() << endl;
+    FileExtraInfo extra;
+    reader.Read(extra.stripe_.index_);
+    reader.Read(extra.stripe_.count_);
+    reader.Read(extra.stripe_.unit_);
+    reader.ReadBytes(extra.inline_data_);
+    SetExtra(node, std::move(extra));
 
-    cout << "   end read tellg=" << stream.tellg() << " " << *node << endl;
+    VFS_TRACE(kTree, kDebug, "ReadFileNode " << current << " end=" << reader.Tell());
 }
 
 
-void FileTree::ReadDirectoryNode(shared_ptr<TreeNode>& node, fstream& stream)
+void FileTree::ReadDirectoryNode(NodeId node, BinaryReader& reader)
 {
-    if (!stream.good())
+    if (!reader.Good())
         return;
 
-    auto& dir = node->dir_;
-    read_integer(dir.subnodes_amount_, stream);
-    read_string(dir.name_, stream);
+    auto& current = Node(node);
+    auto& dir = current.DirInfo();
 
-    cout << "[FileTree::ReadDirectoryNode] subnodes_amount=" << dir.subnodes_amount_;
-    cout << " name=" << dir.name_ << " name_length=" << dir.name_.size() << endl;
-    
-    size_t max_read_pos = stream.tellg();
+    uint64_t subnodes_amount = 0;
+    reader.Read(subnodes_amount);
+    reader.Read(current.name_);
+    if (current.name_ >= names_.Size() || subnodes_amount > reader.Size() / sizeof(uint64_t))
+    {
+        reader.Fail();
+        return;
+    }
+
+    VFS_TRACE(kTree, kDebug, "ReadDirectoryNode " << NodeName(node) << " subnodes=" << subnodes_amount);
+
+    dir.unloaded_.resize(subnodes_amount);
+    for (auto& pos : dir.unloaded_)
+        reader.Read(pos);
+}
+
+
+bool FileTree::LoadDirectory(NodeId dir)
+{
+    // загруженная папка не меняется: GetNode зовет это и под разделяемой блокировкой дерева,
+    // а дочитывание идет только под эксклюзивной (StorageFile::LoadPath)
+    if (Node(dir).DirInfo().unloaded_.empty())
+        return true;
+
+    auto unloaded = std::move(Node(dir).DirInfo().unloaded_);
+    Node(dir).DirInfo().unloaded_.clear();
+
+    bool success = true;
+    vector<NodeId> subnodes;
+    subnodes.reserve(unloaded.size());
 
-    for (size_t i = 0; i < dir.subnodes_amount_; i++)
+    BinaryReader reader(image_);
+
+    for (auto pos : unloaded)
     {
-        if (!stream.good())
-            return;
+        reader.Clear();
+        reader.Seek(pos);
 
-        // cout << "tellg: " << stream.tellg() << endl;
-        uint64_t subnode_pos;
-        read_integer(subnode_pos, stream);
-        cout << "[FileTree::ReadDirectoryNode] read subnode of " << dir.name_ << endl;
-        cout << "   pos = " << subnode_pos << endl;
-
-        auto prev_pos = stream.tellg();
-        
-        stream.seekg(subnode_pos);
-        auto sub = ReadNode(stream);
-        if (sub)
-            dir.subnodes_.push_back(sub);
-        max_read_pos = stream.tellg();
-        stream.seekg(prev_pos);
+        // испорченная нода пропускается, остальное дерево остается доступным
+        auto sub = ReadNode(reader, dir);
+        if (sub == kNoNode || !reader.Good())
+        {
+            success = false;
+            continue;
+        }
+
+        subnodes.push_back(sub);
     }
 
-    stream.seekg(max_read_pos);
+    VFS_TRACE(kTree, kDebug, "LoadDirectory " << NodeName(dir) << " subnodes=" << subnodes.size());
+
+    std::sort(subnodes.begin(), subnodes.end(), [this](NodeId a, NodeId b)
+    {
+        return subnode_less(Node(a), Node(b));
+    });
+    Node(dir).DirInfo().subnodes_ = std::move(subnodes);
+
+    return success;
 }
 
 
-void FileTree::InitializeEmptyTree(fstream& stream)
+void FileTree::LoadAll()
 {
-    root_ = std::make_shared<TreeNode>(string(kDefaultRootName), TreeNode::kDirectory);
-    cout << "[FileTree::InitializeEmptyTree] begin write" << endl;
-    Write(stream);
-    cout << "[FileTree::InitializeEmptyTree] end write" << endl;
+    if (root_ == kNoNode)
+        return;
+
+    std::stack<NodeId> stack;
+    stack.push(root_);
+
+    while (!stack.empty())
+    {
+        auto current = stack.top();
+        stack.pop();
+
+        if (!Node(current).IsDirectory())
+            continue;
+
+        LoadDirectory(current);
+        for (auto next : Node(current).DirInfo().subnodes_)
+            stack.push(next);
+    }
+
+    image_.clear();
+    image_.shrink_to_fit();
 }
 
 
-void FileTree::Write(fstream& stream)
+void FileTree::InitializeEmptyTree()
 {
+    nodes_.clear();
+    extras_.clear();
+    names_.Clear();
+    image_.clear();
+    root_ = NewNode(names_.Intern(string(kDefaultRootName)), TreeNode::kDirectory, kNoNode);
     tree_size_ = CalcSize();
-    // cout << "SIZE CALCULATED: " << tree_size_ << endl;
-    stream.seekp(0);
-    write_integer(tree_size_, stream);
-    WriteNode(root_, stream);
+}
+
+
+void FileTree::Write(BinaryWriter& writer)
+{
+    // смещения в старом образе после записи уже не нужны
+    LoadAll();
+
+    // указатели на ноды считаются от начала writer, так что он должен быть пустым
+    writer.Write(CalcSize());
+    names_.Write(writer);
+    WriteNode(root_, writer);
 
-    tree_size_ = stream.tellp();
-    stream.seekp(0);
-    // cout << "write tree size = " << tree_size_ << endl;
-    write_integer(tree_size_, stream);
+    tree_size_ = writer.Tell();
+    writer.WriteAt(0, tree_size_);
 }
 
 
-uint64_t FileTree::WriteNode(shared_ptr<TreeNode>& node, fstream& stream)
+uint64_t FileTree::WriteNode(NodeId node, BinaryWriter& writer)
 {
-    cout << "[FileTree::WriteNode] type=" << node->type_ << endl;
-    uint64_t pos = stream.tellp();
+    uint64_t pos = writer.Tell();
     
-    write_integer(node->type_, stream);
+    writer.Write(Node(node).Type());
 
-    if (node->IsDirectory())
-        WriteDirectoryNode(node, stream);
-    else if (node->IsFile())
-        WriteFileNode(node, stream);
+    if (Node(node).IsDirectory())
+        WriteDirectoryNode(node, writer);
+    else
+        WriteFileNode(node, writer);
     
     return pos;
 }
 
 
 
-void FileTree::WriteDirectoryNode(shared_ptr<TreeNode>& node, fstream& stream)
+void FileTree::WriteDirectoryNode(NodeId node, BinaryWriter& writer)
 {
-    auto& dir = node->dir_;
-    cout << "[FileTree::WriteDirectoryNode] " << *node << endl;
+    auto& current = Node(node);
+    auto& dir = current.DirInfo();
+    VFS_TRACE(kTree, kDebug, "WriteDirectoryNode " << current);
     
-    write_integer(dir.subnodes_amount_, stream);
-    stream.write(dir.name_.c_str(), dir.name_.size() + 1);
+    writer.Write(uint64_t(dir.subnodes_.size()));
+    writer.Write(current.name_);
 
-    uint64_t nodes_array = stream.tellp();
-    fill_bytes(dir.subnodes_.size() * sizeof(uint64_t), 0, stream);
+    uint64_t nodes_array = writer.Tell();
+    writer.Fill(dir.subnodes_.size() * sizeof(uint64_t), 0);
     
-    for (auto& sub : dir.subnodes_)
+    for (auto sub : dir.subnodes_)
     {
-        uint64_t pos = WriteNode(sub, stream);
-        auto prev_pos = stream.tellp();
-        
-        stream.seekp(nodes_array);
-        write_integer(pos, stream);
+        writer.WriteAt(nodes_array, WriteNode(sub, writer));
         nodes_array += sizeof(uint64_t);
-        
-        stream.seekp(prev_pos);
     }
 }
 
 
 
-void FileTree::WriteFileNode(shared_ptr<TreeNode>& node, fstream& stream)
+void FileTree::WriteFileNode(NodeId node, BinaryWriter& writer)
 {
-    auto& file = node->file_;
+    auto& current = Node(node);
+    auto& file = current.FileInfo();
 
-    cout << "[FileTree::WriteFileNode]" << *node << endl;
+    VFS_TRACE(kTree, kDebug, "WriteFileNode " << current);
 
-    write_integer(file.first_chunk_, stream);
-    write_integer(file.content_size_, stream);
-    stream.write(file.name_.c_str(), file.name_.size() + 1);
-}
+    writer.Write(file.first_chunk_);
+    writer.Write(file.content_size_);
+    writer.Write(current.name_);
 
+    writer.Write(uint64_t(file.extents_.size()));
+    for (const auto& extent : file.extents_)
+    {
+        writer.Write(extent.start_);
+        writer.Write(extent.length_);
+    }
 
-bool FileTree::IsGrown() const
-{
-    return ToChunks(CalcSize()) > ToChunks(tree_size_);
+    auto& extra = Extra(node);
+    writer.Write(extra.stripe_.index_);
+    writer.Write(extra.stripe_.count_);
+    writer.Write(extra.stripe_.unit_);
+    writer.WriteBytes(extra.inline_data_);
 }
 
-// void FileTree::Foreach(uint16_t type, const NodeProcessor& processor)
-// {
-
-// }
 
 bool FileTree::HasPath(const string& path_str, uint16_t type)
 {
-    return bool(GetNode(path_str, type));
+    return GetNode(path_str, type) != kNoNode;
 }
 
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,151 @@
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using IoPool = VFS::IoPool;
+
+
+static thread_local bool in_worker = false;
+
+
+IoPool::IoPool(VFS& vfs, size_t threads) : vfs_(vfs)
+{
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); i++)
+        threads_.emplace_back(&IoPool::Worker, this);
+}
+
+
+IoPool::~IoPool()
+{
+    {
+        lock_guard lock(m_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+
+    // уже отправленные операции выполняются до конца
+    for (auto& t : threads_)
+        t.join();
+}
+
+
+void IoPool::Submit(size_t storage, Request&& request)
+{
+    {
+        lock_guard lock(m_);
+        auto& queue = queues_[storage];
+        queue.requests_.push_back(std::move(request));
+
+        if (queue.busy_ || queue.requests_.size() > 1)
+            return;
+
+        ready_.push_back(storage);
+    }
+    cv_.notify_one();
+}
+
+
+bool IoPool::InWorker()
+{
+    return in_worker;
+}
+
+
+void IoPool::Worker()
+{
+    in_worker = true;
+    vector<Request> batch;
+    unique_lock lock(m_);
+
+    while (true)
+    {
+        cv_.wait(lock, [this] { return stop_ || !ready_.empty(); });
+
+        if (ready_.empty())
+            return;
+
+        size_t storage = ready_.front();
+        ready_.pop_front();
+
+        auto& queue = queues_[storage];
+        queue.busy_ = true;
+        batch.assign(std::make_move_iterator(queue.requests_.begin()), std::make_move_iterator(queue.requests_.end()));
+        queue.requests_.clear();
+
+        lock.unlock();
+        Run(batch);
+        batch.clear();
+        lock.lock();
+
+        queue.busy_ = false;
+        if (!queue.requests_.empty())
+        {
+            ready_.push_back(storage);
+            cv_.notify_one();
+        }
+    }
+}
+
+
+void IoPool::Run(vector<Request>& batch)
+{
+    VFS_TRACE(kIo, kDebug, "IoPool batch requests=" << batch.size());
+
+    // файлы в порядке первого появления в пачке
+    vector<File*> files;
+    map<File*, vector<Request*>> by_file;
+
+    for (auto& request : batch)
+    {
+        if (request.task_)
+        {
+            request.task_();
+            continue;
+        }
+
+        auto& requests = by_file[request.file_];
+        if (requests.empty())
+            files.push_back(request.file_);
+        requests.push_back(&request);
+    }
+
+    vector<iovec> iov;
+
+    for (auto* file : files)
+    {
+        auto& requests = by_file[file];
+
+        for (size_t i = 0; i < requests.size();)
+        {
+            if (!requests[i]->write_)
+            {
+                auto* request = requests[i++];
+                size_t read = vfs_.Read(file, request->read_buf_, request->len_);
+                if (request->done_)
+                    request->done_(read);
+                continue;
+            }
+
+            size_t j = i;
+            iov.clear();
+            for (; j < requests.size() && requests[j]->write_; j++)
+                iov.push_back({ const_cast<char*>(requests[j]->write_buf_), requests[j]->len_ });
+
+            size_t written = vfs_.WriteV(file, iov.data(), iov.size());
+
+            // записанные байты раздаются операциям по порядку
+            for (; i < j; i++)
+            {
+                size_t part = std::min(written, requests[i]->len_);
+                written -= part;
+                if (requests[i]->done_)
+                    requests[i]->done_(part);
+            }
+        }
+    }
+}
+
+
+}
@@ -0,0 +1,87 @@
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using JournalRecord = VFS::JournalRecord;
+using FileTree = VFS::FileTree;
+
+
+void JournalRecord::Write(BinaryWriter& writer) const
+{
+    writer.Write(type_);
+    writer.Write(first_chunk_);
+    writer.Write(content_size_);
+    writer.WriteString(path_);
+
+    writer.Write(uint64_t(extents_.size()));
+    for (const auto& extent : extents_)
+    {
+        writer.Write(extent.start_);
+        writer.Write(extent.length_);
+    }
+
+    writer.Write(stripe_.index_);
+    writer.Write(stripe_.count_);
+    writer.Write(stripe_.unit_);
+    writer.WriteBytes(inline_data_);
+}
+
+
+bool JournalRecord::Read(BinaryReader& reader)
+{
+    reader.Read(type_);
+    reader.Read(first_chunk_);
+    reader.Read(content_size_);
+    reader.ReadString(path_);
+
+    uint64_t extents_amount = 0;
+    reader.Read(extents_amount);
+
+    extents_.clear();
+    for (uint64_t i = 0; i < extents_amount && reader.Good(); i++)
+    {
+        FileExtent extent;
+        reader.Read(extent.start_);
+        reader.Read(extent.length_);
+        extents_.push_back(extent);
+    }
+
+    reader.Read(stripe_.index_);
+    reader.Read(stripe_.count_);
+    reader.Read(stripe_.unit_);
+    reader.ReadBytes(inline_data_);
+
+    return reader.Good();
+}
+
+
+bool JournalRecord::Apply(FileTree& tree) const
+{
+    if (type_ == kRemoveFile)
+        return tree.RemoveFile(path_);
+
+    if (type_ != kAddFile && type_ != kUpdateFile)
+        return false;
+
+    tree.AddFile(path_, first_chunk_);
+
+    auto node = tree.GetNode(path_, FileTree::TreeNode::kFile);
+    if (node == FileTree::kNoNode)
+        return false;
+
+    auto& file = tree.Node(node).FileInfo();
+    file.first_chunk_ = first_chunk_;
+    file.content_size_ = content_size_;
+    file.extents_ = extents_;
+
+    FileTree::FileExtraInfo extra;
+    extra.stripe_ = stripe_;
+    extra.inline_data_ = inline_data_;
+    tree.SetExtra(node, std::move(extra));
+    return true;
+}
+
+
+}
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <fstream>
 #include <array>
+#include <string>
 
 #include "vfs.h"
 
@@ -9,7 +10,10 @@ using std::cerr;
 using std::boolalpha;
 using std::endl;
 
-int main() {
+int main(int argc, char** argv) {
+
+    if (argc > 1 && std::string(argv[1]) == "--self-test")
+        return TestTask::VFS::SelfTest() ? 0 : 1;
 
     TestTask::VFS vfs;
 
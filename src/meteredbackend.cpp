@@ -0,0 +1,54 @@
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using MeteredBackend = VFS::MeteredBackend;
+using Metrics = VFS::Metrics;
+
+
+MeteredBackend::MeteredBackend(unique_ptr<StorageBackend>&& backend, Metrics::StorageCounters& metrics)
+    : backend_(std::move(backend)), metrics_(metrics)
+{
+
+}
+
+
+bool MeteredBackend::Valid() const
+{
+    return backend_->Valid();
+}
+
+
+size_t MeteredBackend::ReadAt(uint64_t pos, char* buf, size_t len)
+{
+    size_t read = backend_->ReadAt(pos, buf, len);
+    metrics_.Add(Metrics::kDeviceReads);
+    metrics_.Add(Metrics::kDeviceBytesRead, read);
+    return read;
+}
+
+
+size_t MeteredBackend::WriteAt(uint64_t pos, const char* buf, size_t len)
+{
+    size_t written = backend_->WriteAt(pos, buf, len);
+    metrics_.Add(Metrics::kDeviceWrites);
+    metrics_.Add(Metrics::kDeviceBytesWritten, written);
+    return written;
+}
+
+
+uint64_t MeteredBackend::Size()
+{
+    return backend_->Size();
+}
+
+
+void MeteredBackend::Flush()
+{
+    backend_->Flush();
+}
+
+
+}
@@ -0,0 +1,136 @@
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using Metrics = VFS::Metrics;
+
+
+size_t VFS::ThreadShard()
+{
+    static atomic<size_t> next_shard = 0;
+    thread_local size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed);
+    return shard;
+}
+
+
+const char* Metrics::StorageCounterName(size_t counter)
+{
+    static constexpr const char* kNames[kStorageCounters] = {
+        "header_reads",
+        "device_reads",
+        "device_writes",
+        "device_bytes_read",
+        "device_bytes_written",
+        "chunks_allocated",
+        "chunks_freed",
+        "chunks_deduped",
+        "tree_writes",
+        "path_loads",
+        "journal_appends",
+        "lock_waits",
+        "tree_lock_wait_ns",
+        "alloc_lock_wait_ns",
+        "dedup_lock_wait_ns",
+    };
+
+    return counter < kStorageCounters ? kNames[counter] : "?";
+}
+
+
+const char* Metrics::OperationName(size_t operation)
+{
+    static constexpr const char* kNames[kOperations] = {
+        "Open",
+        "Create",
+        "Read",
+        "Write",
+        "Close",
+        "Seek",
+        "Tell",
+        "ReadAt",
+        "WriteAt",
+        "WriteV",
+        "WriteBatch",
+    };
+
+    return operation < kOperations ? kNames[operation] : "?";
+}
+
+
+uint64_t Metrics::Snapshot::Operation(size_t operation, size_t field) const
+{
+    return operations_[operation * kOperationFields + field];
+}
+
+
+Metrics::Snapshot Metrics::Snapshot::Diff(const Snapshot& before) const
+{
+    Snapshot diff = *this;
+
+    for (size_t i = 0; i < operations_.size(); i++)
+        diff.operations_[i] -= std::min(before.operations_[i], operations_[i]);
+
+    for (auto& storage : diff.storages_)
+    {
+        auto it = std::find_if(before.storages_.begin(), before.storages_.end(), [&storage](const Storage& other)
+        {
+            return other.filename_ == storage.filename_;
+        });
+
+        // контейнер появился после первого снимка - его счетчики целиком новые
+        if (it == before.storages_.end())
+            continue;
+
+        for (size_t i = 0; i < kStorageCounters; i++)
+            storage.values_[i] -= std::min(it->values_[i], storage.values_[i]);
+    }
+
+    return diff;
+}
+
+
+void Metrics::Snapshot::PrintText(ostream& os) const
+{
+    for (const auto& storage : storages_)
+    {
+        os << "storage " << storage.filename_ << "\n";
+        for (size_t i = 0; i < kStorageCounters; i++)
+            os << "    " << StorageCounterName(i) << " " << storage.values_[i] << "\n";
+    }
+
+    for (size_t op = 0; op < kOperations; op++)
+    {
+        uint64_t calls = Operation(op, kCalls);
+        if (calls == 0)
+            continue;
+
+        os << "op " << OperationName(op) << " calls " << calls << " bytes " << Operation(op, kBytes)
+           << " avg_us " << Operation(op, kNanos) / calls / 1000.0 << "\n";
+    }
+}
+
+
+void Metrics::Snapshot::PrintJson(ostream& os) const
+{
+    os << "{\"storages\": [";
+    for (size_t s = 0; s < storages_.size(); s++)
+    {
+        os << (s == 0 ? "" : ", ") << "{\"filename\": \"" << storages_[s].filename_ << "\"";
+        for (size_t i = 0; i < kStorageCounters; i++)
+            os << ", \"" << StorageCounterName(i) << "\": " << storages_[s].values_[i];
+        os << "}";
+    }
+
+    os << "], \"operations\": {";
+    for (size_t op = 0; op < kOperations; op++)
+    {
+        os << (op == 0 ? "" : ", ") << "\"" << OperationName(op) << "\": {\"calls\": " << Operation(op, kCalls)
+           << ", \"bytes\": " << Operation(op, kBytes) << ", \"ns\": " << Operation(op, kNanos) << "}";
+    }
+    os << "}}";
+}
+
+
+}
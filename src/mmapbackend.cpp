@@ -0,0 +1,131 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using MmapBackend = VFS::MmapBackend;
+
+
+MmapBackend::MmapBackend(const string& filename)
+{
+    fd_ = ::open(filename.c_str(), O_RDWR);
+    if (fd_ < 0)
+        return;
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0)
+        return;
+
+    size_ = st.st_size;
+    Reserve(std::max<uint64_t>(size_, kDefaultChunkSize));
+}
+
+
+MmapBackend::~MmapBackend()
+{
+    if (data_)
+        munmap(data_, capacity_);
+
+    if (fd_ >= 0)
+    {
+        if (ftruncate(fd_, size_) != 0)
+            cerr << "can't truncate mapped storage file " << __FILE__ << ":" << __LINE__ << endl;
+        ::close(fd_);
+    }
+}
+
+
+bool MmapBackend::Reserve(uint64_t capacity)
+{
+    if (capacity <= capacity_ && data_)
+        return true;
+
+    // растем хотя бы вдвое, чтобы дописывание в конец не переотображало файл на каждый чанк
+    capacity = std::max(capacity, capacity_ * 2);
+    capacity = (capacity + kDefaultChunkSize - 1) / kDefaultChunkSize * kDefaultChunkSize;
+
+    // новое отображение создается до снятия старого: если расширить или отобразить файл
+    // не вышло, старое остается рабочим вместе со своим capacity_
+    if (ftruncate(fd_, capacity) != 0)
+        return false;
+
+    void* data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED)
+        return false;
+
+    if (data_)
+        munmap(data_, capacity_);
+
+    data_ = static_cast<char*>(data);
+    capacity_ = capacity;
+    return true;
+}
+
+
+bool MmapBackend::Valid() const
+{
+    return fd_ >= 0 && data_ != nullptr;
+}
+
+
+size_t MmapBackend::ReadAt(uint64_t pos, char* buf, size_t len)
+{
+    shared_lock lock(m_);
+
+    if (!data_ || pos >= size_)
+        return 0;
+
+    len = std::min<uint64_t>(len, size_ - pos);
+    std::memcpy(buf, data_ + pos, len);
+    return len;
+}
+
+
+size_t MmapBackend::WriteAt(uint64_t pos, const char* buf, size_t len)
+{
+    shared_lock lock(m_);
+
+    if (pos + len > capacity_)
+    {
+        lock.unlock();
+        {
+            unique_lock grow_lock(m_);
+            if (!Reserve(pos + len))
+                return 0;
+        }
+        lock.lock();
+    }
+
+    if (!data_ || pos + len > capacity_)
+        return 0;
+
+    std::memcpy(data_ + pos, buf, len);
+
+    uint64_t size = size_;
+    while (size < pos + len && !size_.compare_exchange_weak(size, pos + len));
+
+    return len;
+}
+
+
+uint64_t MmapBackend::Size()
+{
+    return size_;
+}
+
+
+void MmapBackend::Flush()
+{
+    shared_lock lock(m_);
+    if (data_)
+        msync(data_, capacity_, MS_ASYNC);
+}
+
+
+}
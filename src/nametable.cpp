@@ -0,0 +1,86 @@
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using FileTree = VFS::FileTree;
+using NameTable = FileTree::NameTable;
+
+
+
+NameTable::NameId NameTable::Intern(const string& name)
+{
+    auto [it, inserted] = index_.try_emplace(name, NameId(names_.size()));
+    if (inserted)
+        names_.push_back(&it->first);
+    return it->second;
+}
+
+
+NameTable::NameId NameTable::Find(const string& name) const
+{
+    auto it = index_.find(name);
+    return it == index_.end() ? kNoName : it->second;
+}
+
+
+const string& NameTable::Get(NameId id) const
+{
+    return *names_[id];
+}
+
+
+size_t NameTable::Size() const
+{
+    return names_.size();
+}
+
+
+void NameTable::Clear()
+{
+    names_.clear();
+    index_.clear();
+}
+
+
+uint64_t NameTable::CalcSize() const
+{
+    uint64_t size = sizeof(uint64_t);
+    for (auto name : names_)
+        size += name->size() + 1;
+    return size;
+}
+
+
+void NameTable::Write(BinaryWriter& writer) const
+{
+    writer.Write(uint64_t(names_.size()));
+    for (auto name : names_)
+        writer.WriteString(*name);
+}
+
+
+bool NameTable::Read(BinaryReader& reader)
+{
+    Clear();
+
+    uint64_t amount = 0;
+    reader.Read(amount);
+
+    string name;
+    for (uint64_t i = 0; i < amount && reader.ReadString(name); i++)
+    {
+        // одинаковых имен в сохраненной таблице быть не должно
+        if (Intern(name) != i)
+        {
+            reader.Fail();
+            return false;
+        }
+    }
+
+    return reader.Good();
+}
+
+
+}
@@ -0,0 +1,80 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using PosixBackend = VFS::PosixBackend;
+
+
+PosixBackend::PosixBackend(const string& filename)
+{
+    fd_ = ::open(filename.c_str(), O_RDWR);
+}
+
+
+PosixBackend::~PosixBackend()
+{
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+
+bool PosixBackend::Valid() const
+{
+    return fd_ >= 0;
+}
+
+
+size_t PosixBackend::ReadAt(uint64_t pos, char* buf, size_t len)
+{
+    size_t read = 0;
+
+    while (read < len)
+    {
+        ssize_t got = pread(fd_, buf + read, len - read, pos + read);
+        if (got <= 0)
+            break;
+        read += got;
+    }
+
+    return read;
+}
+
+
+size_t PosixBackend::WriteAt(uint64_t pos, const char* buf, size_t len)
+{
+    size_t written = 0;
+
+    while (written < len)
+    {
+        ssize_t put = pwrite(fd_, buf + written, len - written, pos + written);
+        if (put <= 0)
+            break;
+        written += put;
+    }
+
+    return written;
+}
+
+
+uint64_t PosixBackend::Size()
+{
+    struct stat st;
+    if (fstat(fd_, &st) != 0)
+        return 0;
+    return st.st_size;
+}
+
+
+void PosixBackend::Flush()
+{
+    fdatasync(fd_);
+}
+
+
+}
@@ -0,0 +1,1152 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <csignal>
+#include <sys/resource.h>
+
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using StorageHeader = VFS::StorageHeader;
+using StorageBackend = VFS::StorageBackend;
+using MmapBackend = VFS::MmapBackend;
+namespace fs = std::filesystem;
+
+
+struct VFS::SelfTestAccess
+{
+    static StorageFile& Storage(VFS& vfs, size_t storage)
+    {
+        return vfs.GetStorageFile(storage);
+    }
+
+    static bool CreateStriped(VFS& vfs, const string& path)
+    {
+        return vfs.CreateStriped(path);
+    }
+
+    static vector<FileExtent> Extents(VFS& vfs, size_t storage, const string& path)
+    {
+        auto& sfile = vfs.GetStorageFile(storage);
+        FileTree::FileSnapshot info;
+        sfile.GetFileInfo(sfile.FindFile(path), info);
+        return info.extents_;
+    }
+
+    static size_t NameCount(VFS& vfs, size_t storage)
+    {
+        auto& sfile = vfs.GetStorageFile(storage);
+        auto lock = sfile.LockTreeShared();
+        return sfile.tree_.names_.Size();
+    }
+
+    // перечитывает карту с диска; false, если ее цепочка не сходится с заголовком
+    static bool ReloadBitmap(VFS& vfs, size_t storage, size_t& bitmap_chunks)
+    {
+        auto& sfile = vfs.GetStorageFile(storage);
+        auto lock = sfile.LockAlloc();
+        bool ok = sfile.ReadBitmap();
+        bitmap_chunks = sfile.bitmap_chunks_.size();
+        return ok;
+    }
+
+    static bool DedupLoaded(VFS& vfs, size_t storage)
+    {
+        auto& sfile = vfs.GetStorageFile(storage);
+        auto lock = sfile.LockDedup();
+        return sfile.dedup_loaded_;
+    }
+};
+
+using Access = VFS::SelfTestAccess;
+
+
+namespace
+{
+
+size_t failures = 0;
+
+
+void check(bool ok, const char* what, int line)
+{
+    if (ok)
+        return;
+
+    ++failures;
+    std::cerr << "self test failed: " << what << " (selftest.cpp:" << line << ")" << std::endl;
+}
+
+#define SELF_CHECK(cond) check((cond), #cond, __LINE__)
+
+
+// своя папка на каждую проверку, удаляется вместе с контейнерами
+struct ScratchDir
+{
+    fs::path path_;
+
+    explicit ScratchDir(const string& name)
+    {
+        auto stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+        path_ = fs::temp_directory_path() / ("vfs-selftest-" + name + "-" + std::to_string(stamp));
+        fs::create_directories(path_);
+    }
+
+    ~ScratchDir()
+    {
+        std::error_code ec;
+        fs::remove_all(path_, ec);
+    }
+
+    // путь к новому пустому контейнеру
+    string NewStorage(const string& name) const
+    {
+        string filename = (path_ / name).string();
+        std::ofstream file(filename);
+        return filename;
+    }
+};
+
+
+bool write_file(VFS& vfs, const string& path, string data)
+{
+    File* f = vfs.Create(path.c_str());
+    if (!f)
+        return false;
+
+    size_t written = vfs.Write(f, data.data(), data.size());
+    vfs.Close(f);
+    return written == data.size();
+}
+
+
+bool read_file(VFS& vfs, const string& path, string& data)
+{
+    File* f = vfs.Open(path.c_str());
+    if (!f)
+        return false;
+
+    data.clear();
+    char buf[4096];
+    while (size_t read = vfs.Read(f, buf, sizeof(buf)))
+        data.append(buf, read);
+
+    vfs.Close(f);
+    return true;
+}
+
+
+bool has_content(VFS& vfs, const string& path, const string& expected)
+{
+    string data;
+    return read_file(vfs, path, data) && data == expected;
+}
+
+
+string read_bytes(const string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    return string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+
+void write_header_field(const string& filename, uint64_t pos, uint64_t value)
+{
+    auto backend = StorageBackend::Open(filename, StorageBackendType::kPosix);
+    char buf[sizeof(value)];
+    store_integer(value, buf);
+    backend->WriteAt(pos, buf, sizeof(buf));
+}
+
+
+StorageHeader read_header(const string& filename)
+{
+    auto backend = StorageBackend::Open(filename, StorageBackendType::kPosix);
+    StorageHeader header;
+    header.Read(*backend);
+    return header;
+}
+
+
+// запись журнала легла в чанк, а размер журнала в заголовке остался прежним
+void test_torn_journal_append()
+{
+    ScratchDir dir("journal");
+    string storage = dir.NewStorage("s0");
+
+    {
+        VFS vfs;
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        SELF_CHECK(write_file(vfs, "keep/me", "kept"));
+    }
+
+    uint64_t log_size = read_header(storage).log_size_;
+
+    {
+        VFS vfs;
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        SELF_CHECK(write_file(vfs, "lost/one", "lost"));
+    }
+
+    SELF_CHECK(read_header(storage).log_size_ > log_size);
+    write_header_field(storage, StorageHeader::kLogSizePos, log_size);
+
+    {
+        VFS vfs;
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        SELF_CHECK(has_content(vfs, "keep/me", "kept"));
+        SELF_CHECK(vfs.Open("lost/one") == nullptr);
+        SELF_CHECK(write_file(vfs, "after/crash", "after"));
+    }
+
+    {
+        VFS vfs;
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        SELF_CHECK(has_content(vfs, "keep/me", "kept"));
+        SELF_CHECK(has_content(vfs, "after/crash", "after"));
+    }
+}
+
+
+// контейнер с испорченным деревом не открывается, но и не размечается заново
+void test_damaged_container_kept()
+{
+    ScratchDir dir("damaged");
+    string storage = dir.NewStorage("s0");
+
+    {
+        VFS vfs;
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        SELF_CHECK(write_file(vfs, "keep/me", "kept"));
+    }
+
+    write_header_field(storage, StorageHeader::kTreeSizePos, read_header(storage).tree_size_ + 1);
+    string before = read_bytes(storage);
+
+    {
+        VFS vfs;
+        SELF_CHECK(!vfs.AddStorageFile(storage));
+    }
+
+    SELF_CHECK(read_bytes(storage) == before);
+}
+
+
+// контейнер другой версии формата не открывается и остается как был
+void test_old_version_rejected()
+{
+    ScratchDir dir("version");
+    string storage = dir.NewStorage("s0");
+
+    {
+        VFS vfs;
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        SELF_CHECK(write_file(vfs, "keep/me", "kept"));
+    }
+
+    uint16_t old_version = read_header(storage).version_ - 1;
+    auto backend = StorageBackend::Open(storage, StorageBackendType::kPosix);
+    char buf[sizeof(old_version)];
+    store_integer(old_version, buf);
+    backend->WriteAt(sizeof(uint32_t), buf, sizeof(buf));
+    backend.reset();
+
+    string before = read_bytes(storage);
+
+    {
+        VFS vfs;
+        SELF_CHECK(!vfs.AddStorageFile(storage));
+        SELF_CHECK(vfs.Open("keep/me") == nullptr);
+    }
+
+    SELF_CHECK(read_bytes(storage) == before);
+    SELF_CHECK(read_header(storage).version_ == old_version);
+}
+
+
+// файл не удалось расширить: отображение остается прежним, запись за ним отклоняется
+void test_mmap_grow_failure()
+{
+    ScratchDir dir("mmap");
+    string storage = dir.NewStorage("s0");
+
+    MmapBackend backend(storage);
+    SELF_CHECK(backend.Valid());
+
+    string head(100, 'h');
+    SELF_CHECK(backend.WriteAt(0, head.data(), head.size()) == head.size());
+    uint64_t capacity = backend.capacity_;
+
+    // ftruncate за лимит размера файла дает EFBIG вместо сигнала
+    struct rlimit saved;
+    getrlimit(RLIMIT_FSIZE, &saved);
+    auto old_handler = std::signal(SIGXFSZ, SIG_IGN);
+    struct rlimit limited = saved;
+    limited.rlim_cur = capacity;
+    setrlimit(RLIMIT_FSIZE, &limited);
+
+    string tail(100, 't');
+    SELF_CHECK(backend.WriteAt(capacity * 4, tail.data(), tail.size()) == 0);
+
+    setrlimit(RLIMIT_FSIZE, &saved);
+    std::signal(SIGXFSZ, old_handler);
+
+    SELF_CHECK(backend.Valid() && backend.capacity_ == capacity);
+    SELF_CHECK(backend.WriteAt(head.size(), tail.data(), tail.size()) == tail.size());
+
+    string back(200, '\0');
+    SELF_CHECK(backend.ReadAt(0, back.data(), back.size()) == back.size() && back == head + tail);
+}
+
+
+// ReadAsync и Read/ReadAt одного файла с полосами вперемешку: поток пула ждет блокировку файла,
+// которую держит синхронное чтение, и синхронное чтение не должно ждать этот же пул
+void test_striped_async_mix()
+{
+    ScratchDir dir("striped");
+
+    VFS vfs;
+    vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+    SELF_CHECK(vfs.AddStorageFile(dir.NewStorage("s0")));
+    SELF_CHECK(vfs.AddStorageFile(dir.NewStorage("s1")));
+    vfs.SetIoThreads(2);
+    vfs.SetStriping(2, 0);
+
+    string data(256 * 1024, '\0');
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = char('a' + i * 7 % 26);
+    SELF_CHECK(write_file(vfs, "striped/file", data));
+
+    File* f = vfs.Open("striped/file");
+    SELF_CHECK(f != nullptr);
+    if (!f)
+        return;
+
+    auto run = std::async(std::launch::async, [&]
+    {
+        // асинхронные чтения одного файла идут через одну очередь по порядку, ReadAt позицию не сдвигает
+        const size_t piece = 3000;
+        string async_data(data.size(), '\0');
+        vector<future<size_t>> pending;
+        for (size_t pos = 0; pos < data.size(); pos += piece)
+            pending.push_back(vfs.ReadAsync(f, async_data.data() + pos, std::min(piece, data.size() - pos)));
+
+        bool sync_ok = true;
+        string sync_buf(5000, '\0');
+        for (size_t round = 0; round < 200; round++)
+        {
+            uint64_t offset = round * 1237 % (data.size() - sync_buf.size());
+            size_t read = vfs.ReadAt(f, offset, sync_buf.data(), sync_buf.size());
+            sync_ok = sync_ok && read == sync_buf.size() && sync_buf == data.substr(offset, sync_buf.size());
+        }
+        SELF_CHECK(sync_ok);
+
+        size_t total = 0;
+        for (auto& result : pending)
+            total += result.get();
+        SELF_CHECK(total == data.size() && async_data == data);
+
+        SELF_CHECK(vfs.Seek(f, 0));
+        string tail(data.size(), '\0');
+        auto head = vfs.ReadAsync(f, tail.data(), piece);
+        SELF_CHECK(vfs.Read(f, tail.data() + piece, tail.size() - piece) + head.get() == tail.size());
+    });
+
+    if (run.wait_for(std::chrono::seconds(60)) != std::future_status::ready)
+    {
+        // зависшие потоки не завершить, дальше проверять нечего
+        check(false, "striped read with async reads hangs", __LINE__);
+        std::cerr << "self test: aborted" << std::endl;
+        std::_Exit(1);
+    }
+
+    vfs.Close(f);
+}
+
+
+// полоса не создалась: уже созданные полосы убираются, в том числе после перезапуска
+void test_striped_create_rollback()
+{
+    ScratchDir dir("rollback");
+    vector<string> storages{ dir.NewStorage("s0"), dir.NewStorage("s1"), dir.NewStorage("s2") };
+
+    {
+        VFS vfs;
+        vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+        for (auto& storage : storages)
+            SELF_CHECK(vfs.AddStorageFile(storage));
+        vfs.SetPlacementPolicy(PlacementPolicy::kFirstFit);
+        vfs.SetStriping(3, 0);
+
+        // первая полоса ляжет в s0, а в s1 и s2 путь уже занят
+        SELF_CHECK(Access::Storage(vfs, 1).CreateEmptyFile("x/f"));
+        SELF_CHECK(Access::Storage(vfs, 2).CreateEmptyFile("x/f"));
+
+        SELF_CHECK(!Access::CreateStriped(vfs, "x/f"));
+        SELF_CHECK(!Access::Storage(vfs, 0).HasFile("x/f"));
+        SELF_CHECK(Access::Storage(vfs, 1).HasFile("x/f") && Access::Storage(vfs, 2).HasFile("x/f"));
+    }
+
+    {
+        VFS vfs;
+        for (auto& storage : storages)
+            SELF_CHECK(vfs.AddStorageFile(storage));
+        SELF_CHECK(!Access::Storage(vfs, 0).HasFile("x/f"));
+        SELF_CHECK(Access::Storage(vfs, 1).HasFile("x/f"));
+    }
+}
+
+
+// открытия одного закэшированного пути из нескольких потоков
+void test_cached_lookup_concurrent()
+{
+    ScratchDir dir("lookup");
+
+    VFS vfs;
+    vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+    SELF_CHECK(vfs.AddStorageFile(dir.NewStorage("s0")));
+    SELF_CHECK(vfs.AddStorageFile(dir.NewStorage("s1")));
+    SELF_CHECK(write_file(vfs, "hot/path", "hot"));
+    SELF_CHECK(write_file(vfs, "cold/path", "cold"));
+
+    atomic<size_t> mismatches{ 0 };
+    vector<thread> readers;
+    for (size_t t = 0; t < 4; t++)
+    {
+        readers.emplace_back([&vfs, &mismatches, t]
+        {
+            for (size_t i = 0; i < 500; i++)
+            {
+                bool hot = (i + t) % 2 == 0;
+                if (!has_content(vfs, hot ? "hot/path" : "cold/path", hot ? "hot" : "cold"))
+                    ++mismatches;
+            }
+        });
+    }
+    for (auto& reader : readers)
+        reader.join();
+
+    SELF_CHECK(mismatches == 0);
+}
+
+
+// данные файла не растят контейнер за лимит, запасной контейнер появляется в фоне
+void test_size_limit_and_spare()
+{
+    ScratchDir dir("limit");
+    string storage = dir.NewStorage("s0");
+    string spare = (dir.path_ / "spare-0").string();
+    const size_t limit = 64 * 4096;
+
+    string data(4 * limit, '\0');
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = char(i * 31 % 251);
+
+    size_t written = 0;
+    {
+        VFS vfs;
+        vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+        SELF_CHECK(vfs.SetStorageFileSizeLimit(limit));
+        SELF_CHECK(vfs.AddStorageFile(storage));
+
+        File* f = vfs.Create("big/file");
+        SELF_CHECK(f != nullptr);
+        if (!f)
+            return;
+        written = vfs.Write(f, data.data(), data.size());
+        vfs.Close(f);
+    }
+
+    SELF_CHECK(written > limit / 2 && written < limit);
+    SELF_CHECK(fs::file_size(storage) <= limit + 8 * 4096);
+    SELF_CHECK(fs::exists(spare));
+
+    {
+        VFS vfs;
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        SELF_CHECK(has_content(vfs, "big/file", data.substr(0, written)));
+    }
+}
+
+
+// таблица хешей общая для вызовов одного потока: выход не должен зависеть от предыдущих данных
+void test_codec_table_reset()
+{
+    using ChunkCodec = VFS::ChunkCodec;
+
+    // "GHXY" в first впервые встречается на границе совпадения и в таблицу не попадает,
+    // а в second лежит там, где в first стоит такая же четверка
+    string first = "ABCDEFGHABCDEFGHXY0123456789GHXYjklm";
+    string second = "abcdefghijklmnGHXY";
+
+    auto pack = [](const string& data)
+    {
+        string packed(data.size() + 16, '\0');
+        packed.resize(ChunkCodec::Compress(data.data(), data.size(), packed.data(), packed.size()));
+        return packed;
+    };
+
+    string alone = pack(first);
+    pack(second);
+    string after = pack(first);
+    SELF_CHECK(!alone.empty() && alone == after);
+
+    string unpacked(first.size(), '\0');
+    SELF_CHECK(ChunkCodec::Decompress(after.data(), after.size(), unpacked.data(), unpacked.size()) && unpacked == first);
+}
+
+
+// полосы и встроенное содержимое лежат вне нод: переживают контрольную точку и перезапуск
+void test_file_extras_persist()
+{
+    ScratchDir dir("extras");
+    vector<string> storages{ dir.NewStorage("s0"), dir.NewStorage("s1") };
+
+    string striped(300 * 1024, '\0');
+    for (size_t i = 0; i < striped.size(); i++)
+        striped[i] = char('A' + i * 13 % 26);
+
+    const size_t files = 1000;
+    auto inline_path = [](size_t i) { return "inline/" + std::to_string(i % 10) + "/f" + std::to_string(i); };
+    auto inline_content = [](size_t i) { return "inline content " + std::to_string(i); };
+
+    {
+        VFS vfs;
+        vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+        for (auto& storage : storages)
+            SELF_CHECK(vfs.AddStorageFile(storage));
+
+        vfs.SetPlacementPolicy(PlacementPolicy::kFirstFit);
+        vfs.SetStriping(2, 0);
+        SELF_CHECK(write_file(vfs, "striped/file", striped));
+        vfs.SetStriping(1);
+
+        // журнал переполняется, и дерево с полосами и встроенными файлами пишется целиком
+        for (size_t i = 0; i < files; i++)
+            SELF_CHECK(write_file(vfs, inline_path(i), inline_content(i)));
+    }
+
+    // в s1 только вторая полоса, его дерево так и осталось пустым
+    SELF_CHECK(read_header(storages[0]).tree_size_ > read_header(storages[1]).tree_size_);
+
+    {
+        VFS vfs;
+        for (auto& storage : storages)
+            SELF_CHECK(vfs.AddStorageFile(storage));
+
+        SELF_CHECK(has_content(vfs, "striped/file", striped));
+        size_t mismatches = 0;
+        for (size_t i = 0; i < files; i++)
+            mismatches += has_content(vfs, inline_path(i), inline_content(i)) ? 0 : 1;
+        SELF_CHECK(mismatches == 0);
+    }
+}
+
+
+// файлы, которые пишутся вперемешку, все равно лежат несколькими длинными экстентами,
+// а следующий файл занимает участки, освобожденные очисткой, а не хвост контейнера
+void test_free_run_allocation()
+{
+    ScratchDir dir("runs");
+    string storage = dir.NewStorage("s0");
+
+    string a, b;
+    for (size_t i = 0; i < 200 * 1024; i++)
+    {
+        a.push_back(char('a' + i * 7 % 26));
+        b.push_back(char('A' + i * 11 % 26));
+    }
+    string c(100 * 1024, 'c');
+
+    auto end_of = [](const vector<FileExtent>& extents)
+    {
+        uint64_t end = 0;
+        for (auto& extent : extents)
+            end = std::max(end, extent.start_ + extent.length_ * 4096);
+        return end;
+    };
+
+    {
+        VFS vfs;
+        vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+        SELF_CHECK(vfs.AddStorageFile(storage));
+
+        File* fa = vfs.Create("runs/a");
+        File* fb = vfs.Create("runs/b");
+        SELF_CHECK(fa != nullptr && fb != nullptr);
+        if (!fa || !fb)
+            return;
+
+        const size_t piece = 3000;
+        for (size_t pos = 0; pos < a.size(); pos += piece)
+        {
+            size_t len = std::min(piece, a.size() - pos);
+            SELF_CHECK(vfs.Write(fa, a.data() + pos, len) == len);
+            SELF_CHECK(vfs.Write(fb, b.data() + pos, len) == len);
+        }
+        vfs.Close(fa);
+        vfs.Close(fb);
+
+        // по чанку на запись было бы около пятидесяти экстентов
+        auto extents_a = Access::Extents(vfs, 0, "runs/a");
+        auto extents_b = Access::Extents(vfs, 0, "runs/b");
+        SELF_CHECK(!extents_a.empty() && extents_a.size() <= 8);
+        SELF_CHECK(!extents_b.empty() && extents_b.size() <= 8);
+
+        SELF_CHECK(write_file(vfs, "runs/a", ""));
+        SELF_CHECK(write_file(vfs, "runs/c", c));
+
+        auto extents_c = Access::Extents(vfs, 0, "runs/c");
+        SELF_CHECK(!extents_c.empty() && extents_c.size() <= 2);
+        SELF_CHECK(end_of(extents_c) <= std::max(end_of(extents_a), end_of(extents_b)));
+    }
+
+    {
+        VFS vfs;
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        SELF_CHECK(has_content(vfs, "runs/a", ""));
+        SELF_CHECK(has_content(vfs, "runs/b", b));
+        SELF_CHECK(has_content(vfs, "runs/c", c));
+    }
+}
+
+// ReadAt/WriteAt с произвольных смещений поперек границ чанков, позиция файла при этом не сдвигается
+void test_positional_io()
+{
+    ScratchDir dir("positional");
+    string storage = dir.NewStorage("s0");
+
+    string data(300 * 1024, '\0');
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = char('a' + i * 7 % 26);
+
+    {
+        VFS vfs;
+        vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+        SELF_CHECK(vfs.AddStorageFile(storage));
+
+        File* f = vfs.Create("pos/file");
+        SELF_CHECK(f != nullptr);
+        if (!f)
+            return;
+        SELF_CHECK(vfs.Write(f, data.data(), data.size()) == data.size());
+
+        // перезапись середины, дописывание с конца файла и отказ писать за концом
+        string patch(10000, 'X');
+        SELF_CHECK(vfs.WriteAt(f, 5000, patch.data(), patch.size()) == patch.size());
+        data.replace(5000, patch.size(), patch);
+
+        string tail(3000, 'T');
+        SELF_CHECK(vfs.WriteAt(f, data.size(), tail.data(), tail.size()) == tail.size());
+        data += tail;
+        SELF_CHECK(vfs.WriteAt(f, data.size() + 1, tail.data(), tail.size()) == 0);
+        SELF_CHECK(vfs.Tell(f) == data.size() - tail.size());
+
+        SELF_CHECK(!vfs.Seek(f, data.size() + 1));
+        SELF_CHECK(vfs.Seek(f, 100000));
+        string middle(5000, 'M');
+        SELF_CHECK(vfs.Write(f, middle.data(), middle.size()) == middle.size());
+        data.replace(100000, middle.size(), middle);
+        SELF_CHECK(vfs.Tell(f) == 100000 + middle.size());
+
+        vfs.Close(f);
+    }
+
+    {
+        VFS vfs;
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        SELF_CHECK(has_content(vfs, "pos/file", data));
+
+        File* f = vfs.Open("pos/file");
+        SELF_CHECK(f != nullptr);
+        if (!f)
+            return;
+
+        bool matches = true;
+        string buf(5000, '\0');
+        for (size_t round = 0; round < 100; round++)
+        {
+            uint64_t offset = round * 40093 % (data.size() - buf.size());
+            matches = matches && vfs.ReadAt(f, offset, buf.data(), buf.size()) == buf.size() && buf == data.substr(offset, buf.size());
+        }
+        SELF_CHECK(matches);
+        SELF_CHECK(vfs.Tell(f) == 0);
+
+        SELF_CHECK(vfs.ReadAt(f, data.size() - 100, buf.data(), buf.size()) == 100);
+        SELF_CHECK(buf.compare(0, 100, data, data.size() - 100, 100) == 0);
+
+        SELF_CHECK(vfs.Seek(f, 4061));
+        SELF_CHECK(vfs.Read(f, buf.data(), 2) == 2 && buf.compare(0, 2, data, 4061, 2) == 0);
+        SELF_CHECK(vfs.Tell(f) == 4063);
+
+        vfs.Close(f);
+    }
+}
+
+
+// повторяющиеся имена хранятся в таблице один раз, в том числе после контрольной точки и перезапуска
+void test_interned_names()
+{
+    ScratchDir dir("names");
+    string storage = dir.NewStorage("s0");
+
+    const size_t files = 1000;
+    auto path = [](size_t i)
+    {
+        return "set" + std::to_string(i % 10) + "/v" + std::to_string(i / 10 % 10) + "/data/index/f" + std::to_string(i / 100);
+    };
+
+    // set0..9, v0..9, data, index, f0..9 и корень
+    const size_t names = 33;
+
+    {
+        VFS vfs;
+        vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+        SELF_CHECK(vfs.AddStorageFile(storage));
+
+        for (size_t i = 0; i < files; i++)
+            SELF_CHECK(write_file(vfs, path(i), std::to_string(i)));
+
+        // файл и папка с одним именем в одной папке не путаются
+        SELF_CHECK(write_file(vfs, "set0/data", "file"));
+        SELF_CHECK(Access::NameCount(vfs, 0) == names);
+    }
+
+    SELF_CHECK(read_header(storage).log_size_ < read_header(storage).tree_size_);
+
+    {
+        VFS vfs;
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        SELF_CHECK(Access::NameCount(vfs, 0) == names);
+
+        size_t mismatches = 0;
+        for (size_t i = 0; i < files; i++)
+            mismatches += has_content(vfs, path(i), std::to_string(i)) ? 0 : 1;
+        SELF_CHECK(mismatches == 0);
+        SELF_CHECK(has_content(vfs, "set0/data", "file"));
+        SELF_CHECK(has_content(vfs, "set0/v0/data/index/f0", "0"));
+        SELF_CHECK(vfs.Open("set0/v0/data/f0") == nullptr);
+        SELF_CHECK(Access::NameCount(vfs, 0) == names);
+    }
+}
+
+// поля пишутся в буфер и читаются обратно один в один; выход за буфер - ошибка, а не мусор
+void test_binary_reader_writer()
+{
+    BinaryWriter writer;
+    writer.Write(uint8_t(0xAB));
+    writer.Write(uint16_t(0xBEEF));
+    size_t patched = writer.Tell();
+    writer.Write(uint32_t(0));
+    writer.Write(uint64_t(0x0123456789ABCDEF));
+    writer.WriteString("name");
+    writer.WriteBytes(string("a\0b", 3));
+    writer.Fill(3, 'z');
+    writer.WriteAt(patched, uint32_t(0xDEADBEEF));
+    SELF_CHECK(writer.Tell() == 1 + 2 + 4 + 8 + 5 + 4 + 3 + 3);
+
+    string data = writer.Take();
+    BinaryReader reader(data);
+    uint8_t u8 = 0;
+    uint16_t u16 = 0;
+    uint32_t u32 = 0;
+    uint64_t u64 = 0;
+    string name, bytes;
+    SELF_CHECK(reader.Read(u8) && u8 == 0xAB);
+    SELF_CHECK(reader.Read(u16) && u16 == 0xBEEF);
+    SELF_CHECK(reader.Read(u32) && u32 == 0xDEADBEEF);
+    SELF_CHECK(reader.Read(u64) && u64 == 0x0123456789ABCDEF);
+    SELF_CHECK(reader.ReadString(name) && name == "name");
+    SELF_CHECK(reader.ReadBytes(bytes) && bytes == string("a\0b", 3));
+    SELF_CHECK(reader.Tell() == data.size() - 3);
+
+    // четырех байт уже нет, и ошибка остается до конца
+    SELF_CHECK(!reader.Read(u32) && u32 == 0);
+    SELF_CHECK(!reader.Good());
+    reader.Seek(0);
+    SELF_CHECK(!reader.Read(u8));
+
+    string unterminated = "abc";
+    BinaryReader no_nul(unterminated);
+    SELF_CHECK(!no_nul.ReadString(name) && !no_nul.Good());
+
+    BinaryWriter short_bytes;
+    short_bytes.Write(uint32_t(100));
+    short_bytes.Fill(10, 'x');
+    BinaryReader truncated(short_bytes.Data());
+    SELF_CHECK(!truncated.ReadBytes(bytes) && bytes.empty() && !truncated.Good());
+}
+
+
+// дерево с длинными и непечатными именами и заголовок переживают запись и чтение через буфер
+void test_metadata_round_trip()
+{
+    ScratchDir dir("metadata");
+    string storage = dir.NewStorage("s0");
+
+    string long_name(3000, 'n');
+    string odd_name = "\x01\xff \xd0\xb8\xd0\xbc\xd1\x8f";
+    vector<string> paths{ "a/" + long_name, long_name + "/" + odd_name, odd_name + "/x", "a/b/c/d/e/f/g/h" };
+
+    {
+        VFS vfs;
+        vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        for (size_t i = 0; i < paths.size(); i++)
+            SELF_CHECK(write_file(vfs, paths[i], string(i * 5000 + 1, char('0' + i))));
+    }
+
+    StorageHeader written = read_header(storage);
+    SELF_CHECK(written.chunk_size_ == 4096 && written.tree_chunk_ != 0 && written.log_chunk_ != 0);
+    SELF_CHECK(written.chunks_amount_ > 1 && written.bitmap_chunk_ != 0);
+
+    {
+        VFS vfs;
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        for (size_t i = 0; i < paths.size(); i++)
+            SELF_CHECK(has_content(vfs, paths[i], string(i * 5000 + 1, char('0' + i))));
+    }
+
+    StorageHeader reread = read_header(storage);
+    SELF_CHECK(reread.tree_chunk_ == written.tree_chunk_ && reread.tree_size_ == written.tree_size_);
+    SELF_CHECK(reread.chunks_amount_ == written.chunks_amount_ && reread.bitmap_size_ == written.bitmap_size_);
+}
+
+// кольцо трассировки хранит последние kCapacity записей по порядку, параллельные писатели
+// ничего не теряют из счета; на уровне 0 трассировка не оставляет записей вообще
+void test_trace_buffer()
+{
+    auto buffer = std::make_unique<TraceBuffer>();
+    const size_t extra = 10;
+    for (size_t i = 0; i < TraceBuffer::kCapacity + extra; i++)
+        buffer->Push(TraceCategory::kAlloc, TraceLevel::kInfo, "msg " + std::to_string(i));
+    buffer->Push(TraceCategory::kIo, TraceLevel::kDebug, string(2 * TraceBuffer::kTextSize, 'L'));
+
+    std::ostringstream os;
+    buffer->Dump(os);
+    vector<string> lines;
+    std::istringstream is(os.str());
+    for (string line; std::getline(is, line);)
+        lines.push_back(line);
+
+    SELF_CHECK(buffer->Pushed() == TraceBuffer::kCapacity + extra + 1);
+    SELF_CHECK(lines.size() == TraceBuffer::kCapacity);
+    SELF_CHECK(!lines.empty() && lines.front().find("[alloc:2] msg " + std::to_string(extra + 1)) != string::npos);
+    SELF_CHECK(!lines.empty() && lines.back().find("[io:3] " + string(TraceBuffer::kTextSize - 1, 'L')) != string::npos);
+    SELF_CHECK(!lines.empty() && lines.back().find(string(TraceBuffer::kTextSize, 'L')) == string::npos);
+
+    auto shared = std::make_unique<TraceBuffer>();
+    vector<thread> writers;
+    for (size_t t = 0; t < 4; t++)
+    {
+        writers.emplace_back([&shared, t]
+        {
+            for (size_t i = 0; i < 5000; i++)
+                shared->Push(TraceCategory::kTree, TraceLevel::kError, "writer " + std::to_string(t));
+        });
+    }
+    for (auto& writer : writers)
+        writer.join();
+
+    std::ostringstream shared_os;
+    shared->Dump(shared_os);
+    string dump = shared_os.str();
+    SELF_CHECK(shared->Pushed() == 4 * 5000);
+    SELF_CHECK(size_t(std::count(dump.begin(), dump.end(), '\n')) <= TraceBuffer::kCapacity);
+    SELF_CHECK(dump.find("[tree:1] writer ") != string::npos);
+
+    size_t before = TraceBuffer::Instance().Pushed();
+    VFS_TRACE(kTree, kError, "self test " << 1);
+    SELF_CHECK(TraceBuffer::Instance().Pushed() == before + (trace_enabled(TraceCategory::kTree, TraceLevel::kError) ? 1 : 0));
+
+    if constexpr (VFS_TRACE_LEVEL == 0)
+    {
+        ScratchDir dir("trace");
+        VFS vfs;
+        vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+        SELF_CHECK(vfs.AddStorageFile(dir.NewStorage("s0")));
+        SELF_CHECK(write_file(vfs, "trace/file", string(100000, 't')));
+        SELF_CHECK(has_content(vfs, "trace/file", string(100000, 't')));
+        SELF_CHECK(TraceBuffer::Instance().Pushed() == before);
+    }
+}
+
+// счетчики операций и контейнера из нескольких потоков складываются без потерь, разница снимков - только новое
+void test_metrics_counters()
+{
+    using Metrics = VFS::Metrics;
+
+    ScratchDir dir("metrics");
+    VFS vfs;
+    vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+    string storage = dir.NewStorage("s0");
+    SELF_CHECK(vfs.AddStorageFile(storage));
+    SELF_CHECK(write_file(vfs, "warm/up", "warm"));
+
+    const size_t threads = 4;
+    const size_t files = 25;
+    const string data(10000, 'm');
+
+    auto before = vfs.GetMetrics();
+
+    atomic<size_t> mismatches{ 0 };
+    vector<thread> workers;
+    for (size_t t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t]
+        {
+            for (size_t i = 0; i < files; i++)
+            {
+                string path = "m" + std::to_string(t) + "/f" + std::to_string(i);
+                if (!write_file(vfs, path, data) || !has_content(vfs, path, data))
+                    ++mismatches;
+            }
+        });
+    }
+    for (auto& worker : workers)
+        worker.join();
+    SELF_CHECK(mismatches == 0);
+
+    auto diff = vfs.GetMetrics().Diff(before);
+    const size_t total = threads * files;
+    SELF_CHECK(diff.Operation(Metrics::kCreate, Metrics::kCalls) == total);
+    SELF_CHECK(diff.Operation(Metrics::kWrite, Metrics::kCalls) == total);
+    SELF_CHECK(diff.Operation(Metrics::kWrite, Metrics::kBytes) == total * data.size());
+    SELF_CHECK(diff.Operation(Metrics::kOpen, Metrics::kCalls) == total);
+    SELF_CHECK(diff.Operation(Metrics::kRead, Metrics::kBytes) == total * data.size());
+    SELF_CHECK(diff.Operation(Metrics::kClose, Metrics::kCalls) == 2 * total);
+    SELF_CHECK(diff.Operation(Metrics::kSeek, Metrics::kCalls) == 0);
+
+    SELF_CHECK(diff.storages_.size() == 1);
+    if (diff.storages_.size() == 1)
+    {
+        auto& values = diff.storages_[0].values_;
+        SELF_CHECK(diff.storages_[0].filename_ == storage);
+        SELF_CHECK(values[Metrics::kChunksAllocated] >= total * 3);
+        SELF_CHECK(values[Metrics::kDeviceBytesWritten] >= total * data.size());
+        SELF_CHECK(values[Metrics::kJournalAppends] >= total);
+        SELF_CHECK(values[Metrics::kChunksFreed] == 0);
+    }
+
+    auto now = vfs.GetMetrics();
+    auto none = now.Diff(now);
+    SELF_CHECK(none.Operation(Metrics::kCreate, Metrics::kCalls) == 0);
+    SELF_CHECK(!none.storages_.empty() && none.storages_[0].values_[Metrics::kChunksAllocated] == 0);
+
+    std::ostringstream json;
+    diff.PrintJson(json);
+    SELF_CHECK(json.str().find("\"Create\": {\"calls\": " + std::to_string(total) + ",") != string::npos);
+    SELF_CHECK(json.str().find("\"journal_appends\": ") != string::npos);
+}
+
+// контейнер с мелкими чанками: размер чанка берется из заголовка, а не из настроек VFS,
+// и карта занятых чанков, выросшая на несколько чанков, читается с диска после перезапуска
+void test_small_chunks_remount()
+{
+    ScratchDir dir("chunks");
+    string small = dir.NewStorage("s0");
+    string large = dir.NewStorage("s1");
+
+    // чанк карты в 512 байт покрывает меньше 4000 чанков, файлов больше
+    const size_t files = 80;
+    auto content = [](size_t i) { return string(30000 + i * 100, char('a' + i % 26)); };
+    auto path = [](size_t i) { return "chunks/f" + std::to_string(i); };
+
+    size_t used_chunks = 0;
+    {
+        VFS vfs;
+        vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+        SELF_CHECK(!vfs.SetChunkSize(1000));
+        SELF_CHECK(vfs.SetChunkSize(512));
+        SELF_CHECK(vfs.AddStorageFile(small));
+        vfs.SetChunkSize(65536);
+        SELF_CHECK(vfs.AddStorageFile(large));
+        vfs.SetPlacementPolicy(PlacementPolicy::kFirstFit);
+
+        for (size_t i = 0; i < files; i++)
+            SELF_CHECK(write_file(vfs, path(i), content(i)));
+        SELF_CHECK(write_file(vfs, "shrink/me", string(100000, 's')));
+        SELF_CHECK(write_file(vfs, "shrink/me", "s"));
+        used_chunks = vfs.GetStorageStats()[0].usage_.used_chunks_;
+    }
+
+    auto header = read_header(small);
+    SELF_CHECK(header.chunk_size_ == 512 && read_header(large).chunk_size_ == 65536);
+    SELF_CHECK(header.chunks_amount_ > 8 * 478);
+    SELF_CHECK(header.bitmap_size_ > 478);
+
+    {
+        VFS vfs;
+        vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+        SELF_CHECK(vfs.AddStorageFile(small));
+        SELF_CHECK(vfs.GetStorageStats()[0].usage_.used_chunks_ == used_chunks);
+
+        size_t bitmap_chunks = 0;
+        SELF_CHECK(Access::ReloadBitmap(vfs, 0, bitmap_chunks) && bitmap_chunks > 1);
+        SELF_CHECK(vfs.GetStorageStats()[0].usage_.used_chunks_ == used_chunks);
+
+        // новые файлы занимают только свободные чанки и не задевают старые
+        for (size_t i = files; i < 2 * files; i++)
+            SELF_CHECK(write_file(vfs, path(i), content(i)));
+    }
+
+    {
+        VFS vfs;
+        SELF_CHECK(vfs.AddStorageFile(small));
+        size_t mismatches = 0;
+        for (size_t i = 0; i < 2 * files; i++)
+            mismatches += has_content(vfs, path(i), content(i)) ? 0 : 1;
+        SELF_CHECK(mismatches == 0);
+        SELF_CHECK(has_content(vfs, "shrink/me", "s"));
+
+        size_t bitmap_chunks = 0;
+        SELF_CHECK(Access::ReloadBitmap(vfs, 0, bitmap_chunks) && bitmap_chunks > 2);
+    }
+}
+
+// копия файла делит чанки с оригиналом; после перезапуска индекс не читается при открытии
+// и чтении, а при первой записи загружается и находит чанки, записанные до перезапуска
+void test_dedup_lazy_load()
+{
+    using Metrics = VFS::Metrics;
+
+    ScratchDir dir("dedup");
+    string storage = dir.NewStorage("s0");
+
+    const size_t chunks = 40;
+    string data(chunks * 4062, '\0');
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = char(i / 4062 * 17 + i % 251);
+
+    auto counter = [](VFS& vfs, size_t counter)
+    {
+        return vfs.GetMetrics().storages_[0].values_[counter];
+    };
+    auto used = [](VFS& vfs)
+    {
+        return vfs.GetStorageStats()[0].usage_.used_chunks_;
+    };
+
+    {
+        VFS vfs;
+        vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+        vfs.SetDedup(true);
+        SELF_CHECK(vfs.AddStorageFile(storage));
+
+        SELF_CHECK(write_file(vfs, "dedup/orig", data));
+        size_t used_before = used(vfs);
+        size_t deduped = counter(vfs, Metrics::kChunksDeduped);
+        SELF_CHECK(write_file(vfs, "dedup/copy", data));
+        SELF_CHECK(counter(vfs, Metrics::kChunksDeduped) - deduped == chunks);
+        SELF_CHECK(used(vfs) < used_before + 4);
+    }
+
+    {
+        VFS vfs;
+        vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        SELF_CHECK(has_content(vfs, "dedup/copy", data));
+        SELF_CHECK(!Access::DedupLoaded(vfs, 0));
+        SELF_CHECK(counter(vfs, Metrics::kHeaderReads) < chunks);
+
+        size_t used_before = used(vfs);
+        SELF_CHECK(write_file(vfs, "dedup/third", data));
+        SELF_CHECK(Access::DedupLoaded(vfs, 0));
+        SELF_CHECK(counter(vfs, Metrics::kChunksDeduped) == chunks);
+        SELF_CHECK(used(vfs) < used_before + 4);
+
+        // общие чанки освобождаются только вместе с последней ссылкой
+        SELF_CHECK(write_file(vfs, "dedup/orig", "gone"));
+        SELF_CHECK(write_file(vfs, "dedup/copy", "gone"));
+        SELF_CHECK(used(vfs) >= chunks);
+    }
+
+    {
+        VFS vfs;
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        SELF_CHECK(has_content(vfs, "dedup/third", data));
+        SELF_CHECK(has_content(vfs, "dedup/orig", "gone"));
+        SELF_CHECK(has_content(vfs, "dedup/copy", "gone"));
+    }
+}
+
+// порог встроенных файлов урезается полезной частью чанка своего контейнера;
+// файл ровно на этой границе остается в дереве и читается после перезапуска
+void test_inline_cap_remount()
+{
+    ScratchDir dir("inline");
+    string small = dir.NewStorage("s0");
+    string large = dir.NewStorage("s1");
+
+    // полезная часть чанка в 512 и в 65536 байт
+    const size_t small_cap = 512 - 34;
+    const size_t large_cap = 65536 - 34;
+    string at_cap(small_cap, 'i');
+    string over_cap(small_cap + 1, 'o');
+    string big_inline(large_cap, 'b');
+
+    auto write_one = [&dir](const string& storage, size_t chunk_size, const string& path, const string& data)
+    {
+        VFS vfs;
+        vfs.SetStorageFileFilenamePrefix((dir.path_ / "spare-").string());
+        vfs.SetChunkSize(chunk_size);
+        vfs.SetInlineThreshold(1 << 20);
+        SELF_CHECK(vfs.AddStorageFile(storage));
+        SELF_CHECK(write_file(vfs, path, data));
+        return Access::Extents(vfs, 0, path).empty();
+    };
+
+    SELF_CHECK(write_one(small, 512, "cap/at", at_cap));
+    SELF_CHECK(!write_one(small, 512, "cap/over", over_cap));
+    SELF_CHECK(write_one(large, 65536, "cap/big", big_inline));
+
+    {
+        VFS vfs;
+        SELF_CHECK(vfs.AddStorageFile(small));
+        SELF_CHECK(vfs.AddStorageFile(large));
+        SELF_CHECK(has_content(vfs, "cap/at", at_cap));
+        SELF_CHECK(has_content(vfs, "cap/over", over_cap));
+        SELF_CHECK(has_content(vfs, "cap/big", big_inline));
+        SELF_CHECK(Access::Extents(vfs, 0, "cap/at").empty());
+        SELF_CHECK(Access::Extents(vfs, 1, "cap/big").empty());
+    }
+}
+}
+
+
+bool VFS::SelfTest()
+{
+    failures = 0;
+
+    test_torn_journal_append();
+    test_damaged_container_kept();
+    test_old_version_rejected();
+    test_mmap_grow_failure();
+    test_striped_async_mix();
+    test_striped_create_rollback();
+    test_cached_lookup_concurrent();
+    test_size_limit_and_spare();
+    test_codec_table_reset();
+    test_file_extras_persist();
+    test_free_run_allocation();
+    test_positional_io();
+    test_interned_names();
+    test_binary_reader_writer();
+    test_metadata_round_trip();
+    test_trace_buffer();
+    test_metrics_counters();
+    test_small_chunks_remount();
+    test_dedup_lazy_load();
+    test_inline_cap_remount();
+
+    cout << "self test: " << (failures == 0 ? "ok" : std::to_string(failures) + " failed") << endl;
+    return failures == 0;
+}
+
+
+}
@@ -5,157 +5,1492 @@ namespace TestTask
 
 using StorageFile = VFS::StorageFile;
 using ChunkHeader = VFS::ChunkHeader;
+using StorageBackend = VFS::StorageBackend;
+using CachedBackend = VFS::CachedBackend;
+using ChunkCache = VFS::ChunkCache;
+using MeteredBackend = VFS::MeteredBackend;
+using Metrics = VFS::Metrics;
+using ChunkCodec = VFS::ChunkCodec;
+using DedupIndex = VFS::DedupIndex;
 
 
-StorageFile::StorageFile(string filename)
-    : filename_(filename), stream_(filename, std::ios::binary | std::ios::in | std::ios::out)
+StorageFile::StorageFile(string filename, StorageBackendType backend_type, shared_ptr<ChunkCache> cache, const StorageFormat& format)
+    : filename_(filename), backend_(StorageBackend::Open(filename, backend_type))
 {
-    SetupTree();
-}
+    backend_ = std::make_unique<MeteredBackend>(std::move(backend_), metrics_);
 
+    if (cache)
+        backend_ = std::make_unique<CachedBackend>(std::move(backend_), std::move(cache));
 
-StorageFile::StorageFile(StorageFile&& other)
-    : filename_(std::move(other.filename_)), stream_(std::move(other.stream_)),
-        tree_(std::move(other.tree_))
-{ 
-    
+    if (backend_->Valid())
+        SetupTree(format);
 }
 
 
-void StorageFile::SetupTree()
+void StorageFile::SetupTree(const StorageFormat& format)
 {
-    if (!tree_.Read(stream_))
-        tree_.InitializeEmptyTree(stream_);
+    ++generation_;
+
+    if (header_.Read(*backend_))
+    {
+        layout_.size_ = header_.chunk_size_;
+        inline_cap_ = layout_.PayloadSize();
+        if (ReadTree() && ReplayJournal())
+        {
+            if (!ReadBitmap())
+                RebuildBitmap();
+            // индекс дедупликации читается при первой записи, а не при открытии
+            dedup_.Clear();
+            dedup_loaded_ = false;
+            return;
+        }
+    }
+
+    // размечается только файл без сигнатуры контейнера; в остальных могут быть данные,
+    // а перевода со старых версий формата нет, так что такой контейнер просто не открывается
+    if (header_.magic_ == kStorageMagic)
+    {
+        damaged_ = true;
+        if (header_.version_ != kStorageVersion)
+            std::cerr << "unsupported storage version " << header_.version_ << " (expected " << kStorageVersion << ") in " << filename_ << std::endl;
+        else
+            std::cerr << "damaged storage file " << filename_ << std::endl;
+        return;
+    }
+
+    header_ = StorageHeader();
+    dedup_.Clear();
+    dedup_loaded_ = true;
+    header_.chunk_size_ = uint32_t(format.chunk_size_);
+    header_.compress_ = format.compress_;
+    header_.dedup_ = format.dedup_;
+    layout_.size_ = format.chunk_size_;
+    inline_cap_ = layout_.PayloadSize();
+    free_chunks_.Clear();
+    free_chunks_.Resize(1);
+    free_chunks_.Set(0);
+    bitmap_chunks_.clear();
+    header_.chunks_amount_ = 1;
+    header_.Write(*backend_);
+
+    {
+        auto lock = LockAlloc();
+        WriteBitmap(0);
+    }
+
+    tree_chunks_.clear();
+    log_chunks_.clear();
+    tree_.InitializeEmptyTree();
+    WriteTree();
 }
 
 
 bool StorageFile::Valid()
 {
-    return stream_.good() && filename_ != "";
+    return backend_ && backend_->Valid() && filename_ != "" && !damaged_;
+}
+
+
+// сначала пробуем взять блокировку сразу, и только если не вышло, засекаем ожидание
+template <typename Lock, typename Mutex>
+static Lock wait_lock(Mutex& m, Metrics::StorageCounters& metrics, size_t wait_counter)
+{
+    Lock lock(m, std::try_to_lock);
+    if (lock.owns_lock())
+        return lock;
+
+    auto begin = std::chrono::steady_clock::now();
+    lock.lock();
+    auto waited = std::chrono::steady_clock::now() - begin;
+
+    metrics.Add(Metrics::kLockWaits);
+    metrics.Add(wait_counter, std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count());
+    return lock;
+}
+
+
+shared_lock<shared_mutex> StorageFile::LockTreeShared()
+{
+    return wait_lock<shared_lock<shared_mutex>>(tree_m_, metrics_, Metrics::kTreeLockWaitNs);
+}
+
+
+unique_lock<shared_mutex> StorageFile::LockTree()
+{
+    return wait_lock<unique_lock<shared_mutex>>(tree_m_, metrics_, Metrics::kTreeLockWaitNs);
+}
+
+
+unique_lock<mutex> StorageFile::LockAlloc() const
+{
+    return wait_lock<unique_lock<mutex>>(alloc_m_, metrics_, Metrics::kAllocLockWaitNs);
+}
+
+
+unique_lock<mutex> StorageFile::LockDedup() const
+{
+    return wait_lock<unique_lock<mutex>>(dedup_m_, metrics_, Metrics::kDedupLockWaitNs);
+}
+
+
+StorageFile::Usage StorageFile::GetUsage(size_t size_limit) const
+{
+    auto lock = LockAlloc();
+
+    Usage usage;
+    usage.chunks_ = free_chunks_.Size();
+    usage.used_chunks_ = usage.chunks_ - free_chunks_.FreeCount();
+
+    size_t limit_chunks = std::max<size_t>(layout_.Index(size_limit), 1);
+    usage.free_chunks_ = free_chunks_.FreeCount() + (limit_chunks > usage.chunks_ ? limit_chunks - usage.chunks_ : 0);
+    usage.fill_percent_ = std::min<size_t>(usage.used_chunks_ * 100 / limit_chunks, 100);
+
+    return usage;
+}
+
+
+bool StorageFile::HasSpace(size_t size_limit) const
+{
+    return GetUsage(size_limit).free_chunks_ > 0;
+}
+
+
+void StorageFile::SetSizeLimit(size_t size_limit)
+{
+    auto lock = LockAlloc();
+    size_limit_ = size_limit;
+}
+
+
+bool StorageFile::HasDirectory(const string& path)
+{
+    LoadPath(path, FileTree::TreeNode::kDirectory);
+
+    auto lock = LockTreeShared();
+    return tree_.HasPath(path, FileTree::TreeNode::kDirectory);
 }
 
 
-uint64_t StorageFile::FindFreeChunk()
+void StorageFile::RebuildBitmap()
 {
-    size_t file_chunk_pos = ToChunks(tree_.tree_size_) * kChunkSize;
+    size_t total_chunks = std::max<size_t>(layout_.ToChunks(backend_->Size()), 1);
+
+    free_chunks_.Clear();
+    free_chunks_.Resize(total_chunks);
+    free_chunks_.Set(0);
 
-    while (true)
+    // чанки дерева помечены занятыми в своих заголовках, как и чанки файлов
+    for (size_t i = 1; i < total_chunks; i++)
     {
-        stream_.seekg(file_chunk_pos);
         ChunkHeader header;
-        header.Read(stream_);
+        metrics_.Add(Metrics::kHeaderReads);
+        if (header.Read(*backend_, layout_.ToBytes(i)) && header.refs_ != 0)
+            free_chunks_.Set(i);
+    }
+
+    // чанки нечитаемой цепочки остаются занятыми, карта пишется в новую
+    auto lock = LockAlloc();
+    bitmap_chunks_.clear();
+    header_.chunks_amount_ = 0;
+    WriteBitmap(0, free_chunks_.Size());
+}
 
-        if (!header.filled_ || stream_.eof())
-            break;
 
-        file_chunk_pos += kChunkSize;
+bool StorageFile::ReadBitmap()
+{
+    string data;
+    if (!ReadChain(header_.bitmap_chunk_, header_.bitmap_size_, data, bitmap_chunks_))
+        return false;
+
+    size_t bytes = (header_.chunks_amount_ + 7) / 8;
+    if (header_.chunks_amount_ == 0 || bytes > data.size())
+    {
+        bitmap_chunks_.clear();
+        return false;
     }
-    
-    stream_.clear();
 
-    return file_chunk_pos;
+    free_chunks_.Clear();
+    free_chunks_.Resize(header_.chunks_amount_);
+    for (size_t i = 0; i < bytes; i++)
+        free_chunks_.SetByte(i, uint8_t(data[i]));
+
+    return true;
 }
 
 
-void StorageFile::ShiftChunks(size_t from, size_t shift)
+void StorageFile::WriteBitmap(size_t idx, size_t count)
 {
-    size_t buf_size = shift * kChunkSize;
-    auto buf = std::unique_ptr<char>(new char[buf_size * 2]{});
-    char *buf1 = buf.get();
-    char *buf2 = buf1 + buf_size;
+    size_t payload = layout_.PayloadSize();
+    size_t first = idx;
+    size_t last = idx + std::max<size_t>(count, 1) - 1;
+    bool refs_changed = false;
+
+    // чанк, добавленный в цепочку, сам отмечается в карте и может ее удлинить, поэтому проверка повторяется
+    while ((free_chunks_.Size() + 7) / 8 > bitmap_chunks_.size() * payload)
+    {
+        size_t chunk = free_chunks_.FindFree();
+        if (chunk >= free_chunks_.Size())
+            free_chunks_.Resize(chunk + 1);
+        free_chunks_.Set(chunk);
+        metrics_.Add(Metrics::kChunksAllocated);
+
+        first = std::min(first, chunk);
+        last = std::max(last, chunk);
+
+        uint64_t pos = layout_.ToBytes(chunk);
+        ChunkHeader header;
+        header.used_ = payload;
+        header.Write(*backend_, pos);
+
+        if (bitmap_chunks_.empty())
+        {
+            header_.bitmap_chunk_ = pos;
+        }
+        else
+        {
+            ChunkHeader prev;
+            prev.last_ = false;
+            prev.used_ = payload;
+            prev.next_ = pos;
+            prev.Write(*backend_, bitmap_chunks_.back());
+        }
+
+        bitmap_chunks_.push_back(pos);
+        header_.bitmap_size_ = bitmap_chunks_.size() * payload;
+        refs_changed = true;
+    }
+
+    // байты, в которые карта только что выросла, пишутся целиком
+    if (header_.chunks_amount_ != free_chunks_.Size())
+    {
+        first = std::min<size_t>(first, header_.chunks_amount_);
+        last = std::max(last, free_chunks_.Size() - 1);
+        header_.chunks_amount_ = free_chunks_.Size();
+        refs_changed = true;
+    }
+
+    for (size_t byte = first / 8; byte <= last / 8;)
+    {
+        size_t chunk = byte / payload;
+        size_t end = std::min(last / 8 + 1, (chunk + 1) * payload);
+
+        string bits(end - byte, '\0');
+        for (size_t i = byte; i < end; i++)
+            bits[i - byte] = char(free_chunks_.Byte(i));
+
+        backend_->WriteAt(bitmap_chunks_[chunk] + kChunkHeaderSize + byte % payload, bits.data(), bits.size());
+        byte = end;
+    }
+
+    // заголовок переключается после того, как новые байты карты уже записаны
+    if (refs_changed)
+        header_.WriteBitmapRefs(*backend_);
+}
 
-    size_t cur_pos = from;
 
-    stream_.seekg(from);
-    stream_.read(buf1, buf_size);
-    if (stream_.gcount() == 0)
+void StorageFile::LoadDedupIndex()
+{
+    if (dedup_loaded_)
         return;
 
-    while(true)
+    dedup_.Clear();
+    dedup_loaded_ = true;
+
+    // до загрузки индекса чанки с отпечатками и общие чанки не появляются и не освобождаются,
+    // а остальные для индекса не важны, так что хватает снимка карты
+    ChunkBitmap used;
+    {
+        auto lock = LockAlloc();
+        used = free_chunks_;
+    }
+
+    // ссылки и отпечатки хранятся в заголовках чанков, так что хватает одного прохода по ним
+    for (size_t i = 1; i < used.Size(); i++)
+    {
+        if (!used.Test(i))
+            continue;
+
+        ChunkHeader header;
+        uint64_t pos = layout_.ToBytes(i);
+        metrics_.Add(Metrics::kHeaderReads);
+        if (!header.Read(*backend_, pos) || header.refs_ == 0)
+            continue;
+
+        dedup_.SetRefs(pos, header.refs_);
+        if (header.hash_ != 0)
+            dedup_.Insert(header.hash_, pos);
+    }
+
+    VFS_TRACE(kAlloc, kInfo, filename_ << " LoadDedupIndex chunks=" << dedup_.by_pos_.size() << " shared=" << dedup_.refs_.size());
+}
+
+
+uint64_t StorageFile::AllocateChunk()
+{
+    auto lock = LockAlloc();
+
+    // если свободных чанков нет, FindFree вернет индекс сразу за концом файла
+    size_t idx = free_chunks_.FindFree();
+
+    if (idx >= free_chunks_.Size())
+        free_chunks_.Resize(idx + 1);
+
+    free_chunks_.Set(idx);
+    WriteBitmap(idx);
+    metrics_.Add(Metrics::kChunksAllocated);
+
+    return layout_.ToBytes(idx);
+}
+
+
+uint64_t StorageFile::AllocateRun(uint64_t preferred, size_t want, size_t& length)
+{
+    auto lock = LockAlloc();
+
+    size_t idx = free_chunks_.Size();
+    length = 0;
+
+    if (preferred != kInvalidPos)
+    {
+        idx = layout_.Index(preferred);
+        length = free_chunks_.FreeRunAt(idx, want);
+    }
+
+    // продолжить последний экстент не вышло - берем первый подходящий участок,
+    // а если такого нет, то хвост контейнера
+    if (length == 0)
+    {
+        idx = free_chunks_.FindFreeRun(want);
+        length = free_chunks_.FreeRunAt(idx, want);
+    }
+
+    // за лимитом - только уже свободные чанки внутри файла; целого участка нет - хватит и короче
+    size_t limit = std::max<size_t>(layout_.Index(size_limit_), free_chunks_.Size());
+    length = idx < limit ? std::min(length, limit - idx) : 0;
+    if (length == 0)
+    {
+        idx = free_chunks_.FindFree();
+        length = idx < limit ? std::min(free_chunks_.FreeRunAt(idx, want), limit - idx) : 0;
+    }
+
+    if (length == 0)
+    {
+        VFS_TRACE(kAlloc, kInfo, filename_ << " AllocateRun size limit reached want=" << want);
+        return kInvalidPos;
+    }
+
+    if (idx + length > free_chunks_.Size())
+        free_chunks_.Resize(idx + length);
+
+    for (size_t i = idx; i < idx + length; i++)
+        free_chunks_.Set(i);
+    WriteBitmap(idx, length);
+    metrics_.Add(Metrics::kChunksAllocated, length);
+
+    VFS_TRACE(kAlloc, kDebug, filename_ << " AllocateRun chunk=" << idx << " len=" << length << " want=" << want);
+
+    return layout_.ToBytes(idx);
+}
+
+
+void StorageFile::MarkChunk(uint64_t pos, bool used)
+{
+    auto lock = LockAlloc();
+    size_t idx = layout_.Index(pos);
+
+    if (idx >= free_chunks_.Size())
+        free_chunks_.Resize(idx + 1);
+
+    if (used)
+    {
+        free_chunks_.Set(idx);
+    }
+    else
+    {
+        free_chunks_.Reset(idx);
+        metrics_.Add(Metrics::kChunksFreed);
+    }
+
+    WriteBitmap(idx);
+}
+
+
+bool StorageFile::ReadChain(uint64_t first_chunk, uint64_t size, string& data, vector<uint64_t>& chunks, bool with_tail)
+{
+    chunks.clear();
+    data.clear();
+
+    uint64_t pos = first_chunk;
+
+    // количество чанков ограничивает цепочку на случай петли в испорченном файле
+    while (pos != kInvalidPos && chunks.size() < header_.chunks_amount_)
     {
-        auto prev_pos = stream_.tellg();
-        stream_.read(buf2, buf_size);
-        auto gcount = stream_.gcount();
-            
-        stream_.seekp(prev_pos);
-        stream_.write(buf1, buf_size);
-        
-        if (gcount == 0)
+        ChunkHeader header;
+        metrics_.Add(Metrics::kHeaderReads);
+
+        if (!header.Read(*backend_, pos) || header.refs_ == 0 || header.used_ > layout_.PayloadSize())
             break;
 
-        std::copy(buf2, buf2 + buf_size, buf1);
+        chunks.push_back(pos);
+
+        size_t offset = data.size();
+        data.resize(offset + header.used_);
+        if (backend_->ReadAt(pos + kChunkHeaderSize, &data[offset], header.used_) != header.used_)
+            break;
+
+        pos = header.HasNext() ? header.next_ : kInvalidPos;
+    }
+
+    // хвост за size остается от записи, после которой заголовок не успел обновиться
+    if (with_tail && data.size() >= size)
+    {
+        data.resize(size);
+        pos = kInvalidPos;
+    }
+
+    if (pos != kInvalidPos || data.size() != size)
+    {
+        VFS_TRACE(kChunk, kError, filename_ << " broken chain at " << first_chunk << " read=" << data.size() << " expected=" << size);
+        chunks.clear();
+        return false;
+    }
+
+    VFS_TRACE(kChunk, kDebug, filename_ << " ReadChain " << first_chunk << " chunks=" << chunks.size());
+    return true;
+}
+
+
+void StorageFile::WriteChain(const string& data, vector<uint64_t>& chunks)
+{
+    size_t payload = layout_.PayloadSize();
+    size_t needed = std::max<size_t>((data.size() + payload - 1) / payload, 1);
+
+    while (chunks.size() > needed)
+    {
+        FreeChunk(chunks.back());
+        chunks.pop_back();
+    }
+
+    while (chunks.size() < needed)
+    {
+        chunks.push_back(AllocateChunk());
+    }
+
+    VFS_TRACE(kChunk, kDebug, filename_ << " WriteChain bytes=" << data.size() << " chunks=" << needed);
+
+    for (size_t i = 0; i < needed; i++)
+    {
+        size_t offset = i * payload;
+
+        ChunkHeader header;
+        header.last_ = i + 1 == needed;
+        header.next_ = header.last_ ? kInvalidPos : chunks[i + 1];
+        header.used_ = std::min(payload, data.size() - offset);
+        header.Write(*backend_, chunks[i]);
+
+        backend_->WriteAt(chunks[i] + kChunkHeaderSize, data.data() + offset, header.used_);
     }
+}
+
+
+void StorageFile::AppendChain(const string& data, vector<uint64_t>& chunks, uint64_t size)
+{
+    size_t payload = layout_.PayloadSize();
+    size_t written = 0;
 
-    stream_.clear();
+    while (written < data.size())
+    {
+        size_t offset = size + written;
+        size_t idx = offset / payload;
+        size_t in_chunk = offset % payload;
+
+        if (idx == chunks.size())
+        {
+            auto pos = AllocateChunk();
+
+            if (!chunks.empty())
+            {
+                ChunkHeader prev;
+                prev.last_ = false;
+                prev.used_ = payload;
+                prev.next_ = pos;
+                prev.Write(*backend_, chunks.back());
+            }
+
+            chunks.push_back(pos);
+        }
+
+        size_t part = std::min(payload - in_chunk, data.size() - written);
+
+        ChunkHeader header;
+        header.used_ = in_chunk + part;
+        header.Write(*backend_, chunks[idx]);
+
+        backend_->WriteAt(chunks[idx] + kChunkHeaderSize + in_chunk, data.data() + written, part);
+
+        written += part;
+    }
 }
 
 
-bool StorageFile::CreateEmptyFile(const string& path)
+void StorageFile::FreeChain(vector<uint64_t>& chunks)
 {
-    auto free_chunk = FindFreeChunk();
-    // cout << "after FindFreeChunk stream good: " << stream_.good() << endl;
-    // cout << "found free chunk: " << free_chunk << endl;
+    for (auto pos : chunks)
+    {
+        // общий чанк остается у тех, кто еще на него ссылается
+        if (header_.dedup_)
+        {
+            auto lock = LockDedup();
+            LoadDedupIndex();
+            if (DropRef(pos) > 0)
+                continue;
+        }
+
+        FreeChunk(pos);
+    }
+
+    chunks.clear();
+}
 
-    bool actually_added = tree_.AddFile(path, free_chunk);
-    // cout << "actually_added: " << actually_added << endl;
 
-    if (!actually_added)
+void StorageFile::FreeChunk(uint64_t pos)
+{
+    ChunkHeader free_header;
+    free_header.refs_ = 0;
+    free_header.Write(*backend_, pos);
+    MarkChunk(pos, false);
+}
+
+
+uint32_t StorageFile::DropRef(uint64_t pos)
+{
+    uint32_t refs = dedup_.Release(pos);
+    if (refs > 0)
+        WriteChunkRefs(pos, refs);
+    return refs;
+}
+
+
+void StorageFile::WriteChunkRefs(uint64_t pos, uint32_t refs)
+{
+    // счетчик ссылок - первое поле заголовка
+    char buf[sizeof(refs)];
+    store_integer(refs, buf);
+    backend_->WriteAt(pos, buf, sizeof(buf));
+}
+
+
+bool StorageFile::ReadTree()
+{
+    string data;
+    if (!ReadChain(header_.tree_chunk_, header_.tree_size_, data, tree_chunks_) || data.empty())
         return false;
 
+    return tree_.Read(std::move(data));
+}
 
-    bool should_shift_file_chunks = tree_.IsGrown();
-    // cout << "should_shift_file_chunks: " << should_shift_file_chunks << endl;
 
-    // cout << "before shift stream good: " << stream_.good() << endl;
-    if (should_shift_file_chunks)
+void StorageFile::LoadPath(const string& path, uint16_t type)
+{
     {
-        tree_.ShiftFileChunks(kChunkSize);
-        ShiftChunks(ToBytes(ToChunks(tree_.tree_size_) + 1));
+        auto lock = LockTreeShared();
+        if (tree_.IsLoaded(path, type))
+            return;
+    }
+
+    // папки не выгружаются, так что после дочитывания путь остается загруженным
+    auto lock = LockTree();
+    metrics_.Add(Metrics::kPathLoads);
+    tree_.GetNode(path, type);
+}
+
+
+void StorageFile::WriteTree()
+{
+    BinaryWriter writer;
+    tree_.Write(writer);
+    string data = writer.Take();
+    metrics_.Add(Metrics::kTreeWrites);
+
+    // новая цепочка пишется рядом со старой, и только потом заголовок
+    // переключается на нее, так что прерванная запись не портит дерево
+    vector<uint64_t> new_chunks;
+    WriteChain(data, new_chunks);
+
+    header_.tree_chunk_ = new_chunks[0];
+    header_.tree_size_ = data.size();
+    header_.log_chunk_ = kInvalidPos;
+    header_.log_size_ = 0;
+    header_.WriteRefs(*backend_);
+
+    FreeChain(tree_chunks_);
+    FreeChain(log_chunks_);
+    tree_chunks_ = std::move(new_chunks);
+}
 
-        free_chunk += kChunkSize;
+
+bool StorageFile::ReplayJournal()
+{
+    string data;
+    // журнал дописывается раньше, чем его размер в заголовке, так что проигрываются
+    // только целые записи до log_size_, а недописанная последняя отбрасывается
+    if (!ReadChain(header_.log_chunk_, header_.log_size_, data, log_chunks_, true))
+        return false;
+
+    BinaryReader log(data);
+    JournalRecord record;
+
+    while (!log.AtEnd())
+    {
+        if (!record.Read(log))
+            return false;
+        record.Apply(tree_);
     }
 
-    ChunkHeader empty_file_header;
-    empty_file_header.Write(stream_, free_chunk);
-    
-    // cout << "before wrote stream good: " << stream_.good() << endl;
-    tree_.Write(stream_);
-    // cout << "tree wrote stream good: " << stream_.good() << endl;
+    return true;
+}
+
 
-    return actually_added;
+void StorageFile::AppendJournal(const JournalRecord& record)
+{
+    BinaryWriter writer;
+    record.Write(writer);
+    string data = writer.Take();
+    metrics_.Add(Metrics::kJournalAppends);
+
+    AppendChain(data, log_chunks_, header_.log_size_);
+
+    header_.log_chunk_ = log_chunks_[0];
+    header_.log_size_ += data.size();
+    header_.WriteRefs(*backend_);
+
+    // размер журнала ограничен постоянной, а не размером дерева, чтобы его проигрывание
+    // при открытии не росло вместе с количеством файлов
+    if (header_.log_size_ >= kJournalCheckpointSize)
+        WriteTree();
+}
+
+
+bool StorageFile::CreateEmptyFile(const string& path, const FileStripe& stripe)
+{
+    auto lock = LockTree();
+
+    if (tree_.HasPath(path, FileTree::TreeNode::kFile))
+        return false;
+
+    // чанков у пустого файла нет, они занимаются, когда он перерастет порог встроенного хранения
+    if (!tree_.AddFile(path))
+        return false;
+
+    FileTree::FileExtraInfo extra;
+    extra.stripe_ = stripe;
+    tree_.SetExtra(tree_.GetNode(path, FileTree::TreeNode::kFile), std::move(extra));
+
+    JournalRecord record;
+    record.type_ = JournalRecord::kAddFile;
+    record.path_ = path;
+    record.stripe_ = stripe;
+    AppendJournal(record);
+
+    return true;
+}
+
+
+bool StorageFile::RemoveEmptyFile(const string& path)
+{
+    auto lock = LockTree();
+
+    auto node = tree_.GetNode(path, FileTree::TreeNode::kFile);
+    if (node == FileTree::kNoNode)
+        return false;
+
+    auto& info = tree_.Node(node).FileInfo();
+    if (info.content_size_ != 0 || !info.extents_.empty())
+        return false;
+
+    tree_.RemoveFile(path);
+
+    JournalRecord record;
+    record.type_ = JournalRecord::kRemoveFile;
+    record.path_ = path;
+    AppendJournal(record);
+
+    return true;
 }
 
 
 bool StorageFile::HasFile(const string& path)
 {
+    LoadPath(path, FileTree::TreeNode::kFile);
+
+    auto lock = LockTreeShared();
     return tree_.HasPath(path, FileTree::TreeNode::kFile);
 }
 
 
+VFS::FileTree::NodeId StorageFile::FindFile(const string& path)
+{
+    LoadPath(path, FileTree::TreeNode::kFile);
+
+    auto lock = LockTreeShared();
+    return tree_.GetNode(path, FileTree::TreeNode::kFile);
+}
+
+
+bool StorageFile::GetFileInfo(FileTree::NodeId node, FileTree::FileSnapshot& info)
+{
+    auto lock = LockTreeShared();
+
+    if (node >= tree_.nodes_.size() || !tree_.Node(node).IsFile())
+        return false;
+
+    tree_.GetSnapshot(node, info);
+    return true;
+}
+
+
 bool StorageFile::ClearFile(const string& path)
 {
-    ForeachChunk(path, [](ChunkHeader h, fstream& stream)
+    FileTree::FileSnapshot info;
+    if (!GetFileInfo(FindFile(path), info))
+        return false;
+
+    if (info.extents_.empty() && info.content_size_ == 0)
+        return true;
+
+    vector<uint64_t> chunks;
+    for (const auto& extent : info.extents_)
+        for (uint64_t i = 0; i < extent.length_; i++)
+            chunks.push_back(extent.start_ + layout_.ToBytes(i));
+
+    FreeChain(chunks);
+
+    return CommitFile(path, 0, {});
+}
+
+
+bool StorageFile::CommitFile(const string& path, uint64_t content_size, const vector<FileExtent>& extents,
+                             const string& inline_data)
+{
+    auto lock = LockTree();
+
+    auto node = tree_.GetNode(path, FileTree::TreeNode::kFile);
+    if (node == FileTree::kNoNode)
+        return false;
+
+    auto& file = tree_.Node(node).FileInfo();
+    file.first_chunk_ = extents.empty() ? kInvalidPos : extents[0].start_;
+    file.content_size_ = content_size;
+    file.extents_ = extents;
+
+    FileTree::FileExtraInfo extra;
+    extra.stripe_ = tree_.Extra(node).stripe_;
+    extra.inline_data_ = extents.empty() ? inline_data : string();
+
+    JournalRecord record;
+    record.type_ = JournalRecord::kUpdateFile;
+    record.first_chunk_ = file.first_chunk_;
+    record.content_size_ = content_size;
+    record.path_ = path;
+    record.extents_ = extents;
+    record.stripe_ = extra.stripe_;
+    record.inline_data_ = extra.inline_data_;
+    tree_.SetExtra(node, std::move(extra));
+    AppendJournal(record);
+
+    return true;
+}
+
+
+void StorageFile::TrimFile(File& file)
+{
+    uint64_t needed = std::max<uint64_t>((file.size_ + layout_.PayloadSize() - 1) / layout_.PayloadSize(), 1);
+    uint64_t total = 0;
+    for (const auto& extent : file.extents_)
+        total += extent.length_;
+
+    vector<uint64_t> chunks;
+
+    while (total > needed)
+    {
+        auto& last = file.extents_.back();
+        uint64_t extra = std::min(total - needed, last.length_);
+
+        for (uint64_t i = last.length_ - extra; i < last.length_; i++)
+            chunks.push_back(last.start_ + layout_.ToBytes(i));
+
+        last.length_ -= extra;
+        total -= extra;
+        file.chunk_index_.clear();
+        if (last.length_ == 0)
+            file.extents_.pop_back();
+    }
+
+    VFS_TRACE(kAlloc, kDebug, filename_ << " TrimFile " << file.path_ << " freed=" << chunks.size());
+    FreeChain(chunks);
+}
+
+
+template <typename Func>
+auto StorageFile::WithLayout(Func&& func)
+{
+    switch (layout_.ChunkSize())
+    {
+    case 512:
+        return func(FixedChunkLayout<512>());
+    case 4096:
+        return func(FixedChunkLayout<4096>());
+    case 65536:
+        return func(FixedChunkLayout<65536>());
+    }
+
+    return func(layout_);
+}
+
+
+template <typename Layout>
+size_t StorageFile::ChunkRun(File& file, uint64_t idx, size_t max, uint64_t& pos, Layout layout)
+{
+    if (file.chunk_index_.empty())
+    {
+        for (const auto& extent : file.extents_)
+            for (uint64_t i = 0; i < extent.length_; i++)
+                file.chunk_index_.push_back(extent.start_ + layout.ToBytes(i));
+    }
+
+    const auto& index = file.chunk_index_;
+    if (idx >= index.size())
+        return 0;
+
+    pos = index[idx];
+
+    size_t run = 1;
+    while (run < max && idx + run < index.size() && index[idx + run] == pos + layout.ToBytes(run))
+        ++run;
+
+    return run;
+}
+
+
+template <typename Layout>
+size_t StorageFile::ReadFile(File& file, char* buf, size_t len, Layout layout)
+{
+    size_t read = 0;
+    vector<char> run;
+
+    len = std::min<uint64_t>(len, file.size_ > file.pos_ ? file.size_ - file.pos_ : 0);
+
+    while (read < len)
+    {
+        size_t in_chunk = file.pos_ % layout.PayloadSize();
+        size_t left = len - read;
+
+        // сколько чанков подряд нужно, чтобы дочитать, в пределах экстента
+        size_t want = (in_chunk + left + layout.PayloadSize() - 1) / layout.PayloadSize();
+        uint64_t chunk_pos = 0;
+        size_t chunks = ChunkRun(file, file.pos_ / layout.PayloadSize(), std::min(want, kMaxRunChunks), chunk_pos, layout);
+        if (chunks == 0)
+            break;
+
+        uint64_t from = chunk_pos + kChunkHeaderSize + in_chunk;
+        size_t part = std::min(left, chunks * layout.PayloadSize() - in_chunk);
+
+        if (chunks == 1)
+        {
+            size_t got = backend_->ReadAt(from, buf + read, part);
+            read += got;
+            file.pos_ += got;
+            if (got != part)
+                break;
+            continue;
+        }
+
+        // участок читается целиком вместе с заголовками чанков, потом из него выбираются данные
+        size_t span = layout.ToBytes(chunks - 1) + part - (chunks - 1) * layout.PayloadSize();
+        run.resize(span);
+        size_t got = backend_->ReadAt(from, run.data(), span);
+
+        size_t src = 0;
+        size_t copied = 0;
+        size_t piece = layout.PayloadSize() - in_chunk;
+
+        while (copied < part && src < got)
+        {
+            piece = std::min({piece, part - copied, got - src});
+            std::memcpy(buf + read + copied, run.data() + src, piece);
+            copied += piece;
+            src += piece + kChunkHeaderSize;
+            piece = layout.PayloadSize();
+        }
+
+        read += copied;
+        file.pos_ += copied;
+        if (copied != part)
+            break;
+    }
+
+    return read;
+}
+
+
+template <typename Layout>
+size_t StorageFile::ReadPacked(File& file, char* buf, size_t len, Layout layout)
+{
+    size_t read = 0;
+
+    len = std::min<uint64_t>(len, file.size_ > file.pos_ ? file.size_ - file.pos_ : 0);
+
+    while (read < len)
+    {
+        uint64_t idx = file.pos_ / layout.PayloadSize();
+        size_t in_chunk = file.pos_ % layout.PayloadSize();
+
+        if (file.unpacked_idx_ != idx)
+        {
+            uint64_t chunk_pos = 0;
+            if (ChunkRun(file, idx, 1, chunk_pos, layout) == 0 || !ReadChunk(chunk_pos, layout.PayloadSize(), file.unpacked_))
+            {
+                file.unpacked_idx_ = uint64_t(-1);
+                break;
+            }
+
+            // размер файла главнее заголовка чанка: недописанный хвост читается нулями
+            file.unpacked_idx_ = idx;
+            file.unpacked_.resize(std::min<uint64_t>(layout.PayloadSize(), file.size_ - (file.pos_ - in_chunk)));
+        }
+
+        size_t part = std::min(len - read, file.unpacked_.size() - in_chunk);
+        std::memcpy(buf + read, file.unpacked_.data() + in_chunk, part);
+        read += part;
+        file.pos_ += part;
+    }
+
+    return read;
+}
+
+
+bool StorageFile::ReadChunk(uint64_t pos, size_t payload, string& data)
+{
+    ChunkHeader header;
+    metrics_.Add(Metrics::kHeaderReads);
+    if (!header.Read(*backend_, pos))
+        return false;
+
+    size_t stored = header.Compressed() ? header.stored_ : header.used_;
+    if (header.used_ > payload || stored > payload)
+        return false;
+
+    data.resize(header.used_);
+    if (!header.Compressed())
+        return backend_->ReadAt(pos + kChunkHeaderSize, data.data(), stored) == stored;
+
+    string packed(stored, '\0');
+    if (backend_->ReadAt(pos + kChunkHeaderSize, packed.data(), stored) != stored)
+        return false;
+
+    return ChunkCodec::Decompress(packed.data(), stored, data.data(), data.size());
+}
+
+
+bool StorageFile::WriteChunk(uint64_t pos, const string& data, string& buf, uint64_t hash)
+{
+    ChunkHeader header;
+    header.used_ = data.size();
+    header.hash_ = hash;
+    buf.resize(kChunkHeaderSize + data.size());
+
+    // сжатое хранится, только если оно короче хотя бы на байт
+    size_t stored = header_.compress_ && data.size() > 1 ? ChunkCodec::Compress(data.data(), data.size(), &buf[kChunkHeaderSize], data.size() - 1) : 0;
+    if (stored != 0)
+    {
+        header.flags_ = ChunkHeader::kCompressed;
+        header.stored_ = uint32_t(stored);
+    }
+    else
+    {
+        stored = data.size();
+        data.copy(&buf[kChunkHeaderSize], stored);
+    }
+
+    header.Store(buf.data());
+    return backend_->WriteAt(pos, buf.data(), kChunkHeaderSize + stored) == kChunkHeaderSize + stored;
+}
+
+
+size_t StorageFile::ReadFile(File& file, char* buf, size_t len)
+{
+    if (!file.extents_.empty() && header_.compress_)
+        return WithLayout([&](auto layout) { return ReadPacked(file, buf, len, layout); });
+
+    if (!file.extents_.empty())
+        return WithLayout([&](auto layout) { return ReadFile(file, buf, len, layout); });
+
+    // содержимое пришло вместе с нодой, к контейнеру обращаться не нужно
+    if (file.pos_ >= std::min<uint64_t>(file.size_, file.inline_data_.size()))
+        return 0;
+
+    len = file.inline_data_.copy(buf, std::min<uint64_t>(len, file.size_ - file.pos_), file.pos_);
+    file.pos_ += len;
+    return len;
+}
+
+
+size_t StorageFile::WriteFile(File& file, const char* buf, size_t len)
+{
+    iovec iov{ const_cast<char*>(buf), len };
+    return WriteFile(file, &iov, 1);
+}
+
+
+template <typename Layout>
+size_t StorageFile::WriteFile(File& file, const iovec* iov, size_t count, Layout layout)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++)
+        len += iov[i].iov_len;
+
+    size_t written = 0;
+    vector<char> run;
+
+    // дописать в run следующие n байт из iov
+    size_t iov_idx = 0;
+    size_t iov_offset = 0;
+    auto gather = [&](size_t n)
+    {
+        while (n > 0)
+        {
+            size_t piece = std::min(n, iov[iov_idx].iov_len - iov_offset);
+            const char* src = static_cast<const char*>(iov[iov_idx].iov_base) + iov_offset;
+            run.insert(run.end(), src, src + piece);
+
+            n -= piece;
+            iov_offset += piece;
+            if (iov_offset == iov[iov_idx].iov_len)
+            {
+                ++iov_idx;
+                iov_offset = 0;
+            }
+        }
+    };
+
+    while (written < len)
+    {
+        size_t in_chunk = file.pos_ % layout.PayloadSize();
+        size_t left = len - written;
+        size_t want = (in_chunk + left + layout.PayloadSize() - 1) / layout.PayloadSize();
+
+        uint64_t chunk_pos = 0;
+        size_t chunks = ChunkRun(file, file.pos_ / layout.PayloadSize(), std::min(want, kMaxRunChunks), chunk_pos, layout);
+
+        if (chunks == 0)
+        {
+            if (!GrowFile(file, want, layout))
+                break;
+            continue;
+        }
+
+        uint64_t chunk_offset = file.pos_ - in_chunk;
+        size_t part = std::min(left, chunks * layout.PayloadSize() - in_chunk);
+        uint64_t new_size = std::max(file.size_, file.pos_ + part);
+
+        // в каждом заголовке - сколько байт этого чанка занято с учетом уже записанного
+        auto make_header = [&](size_t i)
+        {
+            ChunkHeader header;
+            header.used_ = std::min<uint64_t>(layout.PayloadSize(), new_size - chunk_offset - i * layout.PayloadSize());
+            return header;
+        };
+
+        run.clear();
+        size_t from = 0;
+
+        if (in_chunk != 0)
+        {
+            // начало первого чанка уже записано, его не трогаем
+            from = kChunkHeaderSize + in_chunk;
+            gather(std::min(part, layout.PayloadSize() - in_chunk));
+            make_header(0).Write(*backend_, chunk_pos);
+        }
+
+        for (size_t i = in_chunk != 0 ? 1 : 0; i < chunks; i++)
+        {
+            size_t offset = i * layout.PayloadSize() - in_chunk;
+            size_t piece = std::min(layout.PayloadSize(), part - offset);
+
+            char header_buf[kChunkHeaderSize];
+            make_header(i).Store(header_buf);
+            run.insert(run.end(), header_buf, header_buf + kChunkHeaderSize);
+            gather(piece);
+        }
+
+        size_t put = backend_->WriteAt(chunk_pos + from, run.data(), run.size());
+
+        if (put != run.size())
+            break;
+
+        written += part;
+        file.pos_ += part;
+        file.size_ = new_size;
+    }
+
+    return written;
+}
+
+
+template <typename Layout>
+size_t StorageFile::WritePacked(File& file, const iovec* iov, size_t count, Layout layout)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++)
+        len += iov[i].iov_len;
+
+    size_t written = 0;
+    size_t iov_idx = 0;
+    size_t iov_offset = 0;
+    string data;
+    string buf;
+
+    file.unpacked_idx_ = uint64_t(-1);
+
+    while (written < len)
     {
-        
-    });
+        size_t in_chunk = file.pos_ % layout.PayloadSize();
+        size_t part = std::min(len - written, layout.PayloadSize() - in_chunk);
+
+        uint64_t idx = file.pos_ / layout.PayloadSize();
+        size_t want = (in_chunk + len - written + layout.PayloadSize() - 1) / layout.PayloadSize();
+
+        // с дедупликацией новый чанк занимается, только если такого содержимого еще нет
+        uint64_t chunk_pos = kInvalidPos;
+        if (ChunkRun(file, idx, 1, chunk_pos, layout) == 0 && !header_.dedup_)
+        {
+            if (!GrowFile(file, want, layout))
+                break;
+            continue;
+        }
+
+        // сжатый чанк нельзя поправить на месте: если запись покрывает его не целиком,
+        // старое содержимое читается, и чанк пишется заново
+        uint64_t chunk_offset = file.pos_ - in_chunk;
+        size_t old_used = file.size_ > chunk_offset ? std::min<uint64_t>(layout.PayloadSize(), file.size_ - chunk_offset) : 0;
+
+        data.clear();
+        if (chunk_pos != kInvalidPos && old_used > 0 && (in_chunk > 0 || in_chunk + part < old_used)
+            && !ReadChunk(chunk_pos, layout.PayloadSize(), data))
+            break;
+        data.resize(std::max(old_used, in_chunk + part));
+
+        for (size_t put = 0; put < part; )
+        {
+            size_t piece = std::min(part - put, iov[iov_idx].iov_len - iov_offset);
+            data.replace(in_chunk + put, piece, static_cast<const char*>(iov[iov_idx].iov_base) + iov_offset, piece);
+
+            put += piece;
+            iov_offset += piece;
+            if (iov_offset == iov[iov_idx].iov_len)
+            {
+                ++iov_idx;
+                iov_offset = 0;
+            }
+        }
+
+        bool put = header_.dedup_ ? WriteDeduped(file, idx, chunk_pos, data, buf, want, layout) : WriteChunk(chunk_pos, data, buf);
+        if (!put)
+            break;
+
+        written += part;
+        file.pos_ += part;
+        file.size_ = std::max(file.size_, file.pos_);
+    }
+
+    return written;
+}
+
+
+template <typename Layout>
+bool StorageFile::GrowFile(File& file, size_t want, Layout layout)
+{
+    // все чанки, нужные под остаток записи, занимаются сразу и по возможности
+    // подряд за последним экстентом; сверху берется запас по размеру файла, чтобы
+    // параллельные писатели не чередовали свои чанки. Лишнее отдается в TrimFile
+    auto& last = file.extents_.back();
+    want += std::min<size_t>(file.pos_ / layout.PayloadSize(), kMaxRunChunks);
+    size_t got = 0;
+    uint64_t start = AllocateRun(last.start_ + layout.ToBytes(last.length_), want, got);
+    if (got == 0)
+        return false;
+
+    if (start == last.start_ + layout.ToBytes(last.length_))
+        last.length_ += got;
+    else
+        file.extents_.push_back({start, got});
+
+    for (size_t i = 0; i < got; i++)
+        file.chunk_index_.push_back(start + layout.ToBytes(i));
+
+    return true;
 }
 
 
-bool StorageFile::ForeachChunk(const string& path, const function<void(ChunkHeader, fstream&)>& processor)
+template <typename Layout>
+bool StorageFile::WriteDeduped(File& file, uint64_t idx, uint64_t pos, const string& data, string& buf, size_t want, Layout layout)
 {
-    auto file_node = tree_.GetNode(path, FileTree::TreeNode::kFile);
-    
-    ChunkHeader current;
-    current.Read(stream_, file_node->file_.first_chunk_);
+    bool full = data.size() == layout.PayloadSize();
+    uint64_t hash = full ? DedupIndex::Fingerprint(data.data(), data.size()) : 0;
+
+    {
+        // поиск, сверка и новая ссылка - под одной блокировкой, чтобы найденный чанк
+        // не успели освободить или переписать
+        auto lock = LockDedup();
+        LoadDedupIndex();
+        uint64_t found = full ? dedup_.Find(hash) : kInvalidPos;
+
+        string existing;
+        if (found != kInvalidPos && ReadChunk(found, layout.PayloadSize(), existing) && existing == data)
+        {
+            metrics_.Add(Metrics::kChunksDeduped);
+            if (found == pos)
+                return true;
+
+            WriteChunkRefs(found, dedup_.AddRef(found));
+            if (pos != kInvalidPos && DropRef(pos) == 0)
+                FreeChunk(pos);
+            ReplaceChunk(file, idx, found, layout);
+            return true;
+        }
+
+        // общий чанк на месте не меняется - файл получает свою копию
+        if (pos != kInvalidPos && dedup_.Refs(pos) > 1)
+        {
+            DropRef(pos);
+            pos = kInvalidPos;
+        }
+        else if (pos != kInvalidPos)
+        {
+            dedup_.Erase(pos);
+        }
+    }
+
+    if (pos == kInvalidPos && idx < file.chunk_index_.size())
+    {
+        pos = AllocateChunk();
+        ReplaceChunk(file, idx, pos, layout);
+    }
+    else if (pos == kInvalidPos)
+    {
+        if (!GrowFile(file, want, layout) || ChunkRun(file, idx, 1, pos, layout) == 0)
+            return false;
+    }
 
-    processor(current, stream_);
+    if (!WriteChunk(pos, data, buf, hash))
+        return false;
 
-    while (current.HasNext())
+    if (full)
     {
-        current.GoNext(stream_);
-        processor(current, stream_);
+        auto lock = LockDedup();
+        dedup_.Insert(hash, pos);
     }
+
+    return true;
 }
 
 
-}
\ No newline at end of file
+template <typename Layout>
+void StorageFile::ReplaceChunk(File& file, uint64_t idx, uint64_t pos, Layout layout)
+{
+    auto& extents = file.extents_;
+
+    if (idx == file.chunk_index_.size())
+    {
+        file.chunk_index_.push_back(pos);
+        extents.push_back({pos, 1});
+    }
+    else
+    {
+        file.chunk_index_[idx] = pos;
+
+        // экстент с этим чанком делится на части до и после него
+        size_t e = 0;
+        for (; idx >= extents[e].length_; e++)
+            idx -= extents[e].length_;
+
+        FileExtent extent = extents[e];
+        vector<FileExtent> parts;
+        if (idx > 0)
+            parts.push_back({extent.start_, idx});
+        parts.push_back({pos, 1});
+        if (idx + 1 < extent.length_)
+            parts.push_back({extent.start_ + layout.ToBytes(idx + 1), extent.length_ - idx - 1});
+
+        extents.erase(extents.begin() + e);
+        extents.insert(extents.begin() + e, parts.begin(), parts.end());
+    }
+
+    // соседние экстенты, ставшие смежными, склеиваются
+    size_t last = 0;
+    for (size_t i = 1; i < extents.size(); i++)
+    {
+        if (extents[last].start_ + layout.ToBytes(extents[last].length_) == extents[i].start_)
+            extents[last].length_ += extents[i].length_;
+        else
+            extents[++last] = extents[i];
+    }
+    extents.resize(last + 1);
+}
+
+
+size_t StorageFile::WriteFile(File& file, const iovec* iov, size_t count)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++)
+        len += iov[i].iov_len;
+
+    if (file.extents_.empty() && std::max(file.size_, file.pos_ + len) <= file.inline_limit_)
+    {
+        if (file.inline_data_.size() < file.pos_ + len)
+            file.inline_data_.resize(file.pos_ + len);
+
+        uint64_t pos = file.pos_;
+        for (size_t i = 0; i < count; i++)
+        {
+            file.inline_data_.replace(pos, iov[i].iov_len, static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+            pos += iov[i].iov_len;
+        }
+
+        file.pos_ = pos;
+        file.size_ = file.inline_data_.size();
+        return len;
+    }
+
+    if (file.extents_.empty() && !SpillInline(file))
+        return 0;
+
+    if (header_.compress_ || header_.dedup_)
+        return WithLayout([&](auto layout) { return WritePacked(file, iov, count, layout); });
+
+    return WithLayout([&](auto layout) { return WriteFile(file, iov, count, layout); });
+}
+
+
+bool StorageFile::SpillInline(File& file)
+{
+    // первый чанк занимается сразу, остальные - обычной записью следом за ним
+    size_t got = 0;
+    uint64_t first = AllocateRun(kInvalidPos, 1, got);
+    if (got == 0)
+        return false;
+
+    string data = std::move(file.inline_data_);
+    file.inline_data_.clear();
+    file.extents_.push_back({first, 1});
+    file.chunk_index_.clear();
+
+    VFS_TRACE(kAlloc, kDebug, filename_ << " SpillInline " << file.path_ << " size=" << data.size());
+
+    uint64_t pos = file.pos_;
+    file.pos_ = 0;
+    file.size_ = 0;
+
+    size_t written = WriteFile(file, data.data(), data.size());
+    file.pos_ = pos;
+
+    return written == data.size();
+}
+
+
+template <typename Layout>
+size_t StorageFile::AppendFile(File& file, const iovec* iov, size_t count, Layout layout)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++)
+        len += iov[i].iov_len;
+
+    size_t in_chunk = file.pos_ % layout.PayloadSize();
+    size_t pending = file.pending_.size();
+    size_t end = in_chunk + pending + len;
+
+    if (end < layout.PayloadSize())
+    {
+        for (size_t i = 0; i < count; i++)
+            file.pending_.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+        return len;
+    }
+
+    // сейчас пишется все до последней границы чанка, остальное ждет
+    size_t now = end / layout.PayloadSize() * layout.PayloadSize() - in_chunk;
+
+    vector<iovec> parts;
+    if (pending > 0)
+        parts.push_back({ file.pending_.data(), pending });
+
+    size_t i = 0;
+    for (size_t taken = pending; taken < now; i++)
+    {
+        size_t piece = std::min(iov[i].iov_len, now - taken);
+        parts.push_back({ iov[i].iov_base, piece });
+        taken += piece;
+    }
+
+    size_t written = WriteFile(file, parts.data(), parts.size());
+    if (written != now)
+    {
+        file.pending_.clear();
+        return written > pending ? written - pending : 0;
+    }
+
+    // остаток последнего частично взятого буфера и все следующие
+    file.pending_.clear();
+    if (i > 0 && parts.back().iov_len < iov[i - 1].iov_len)
+    {
+        size_t piece = parts.back().iov_len;
+        file.pending_.append(static_cast<const char*>(iov[i - 1].iov_base) + piece, iov[i - 1].iov_len - piece);
+    }
+    for (; i < count; i++)
+        file.pending_.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+
+    return len;
+}
+
+
+size_t StorageFile::AppendFile(File& file, const iovec* iov, size_t count)
+{
+    return WithLayout([&](auto layout) { return AppendFile(file, iov, count, layout); });
+}
+
+
+bool StorageFile::FlushFile(File& file)
+{
+    if (file.pending_.empty())
+        return true;
+
+    size_t size = file.pending_.size();
+    size_t written = WriteFile(file, file.pending_.data(), size);
+    file.pending_.clear();
+
+    return written == size;
+}
+
+
+bool StorageFile::ForeachChunk(const string& path, const function<void(const ChunkHeader&, StorageBackend&)>& processor)
+{
+    FileTree::FileSnapshot info;
+    if (!GetFileInfo(FindFile(path), info))
+        return false;
+
+    for (const auto& extent : info.extents_)
+    {
+        for (uint64_t i = 0; i < extent.length_; i++)
+        {
+            ChunkHeader current;
+            metrics_.Add(Metrics::kHeaderReads);
+            if (!current.Read(*backend_, extent.start_ + layout_.ToBytes(i)))
+                return false;
+            processor(current, *backend_);
+        }
+    }
+
+    return true;
+}
+
+
+}
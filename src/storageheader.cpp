@@ -0,0 +1,85 @@
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using StorageHeader = VFS::StorageHeader;
+using StorageBackend = VFS::StorageBackend;
+
+
+bool StorageHeader::Read(StorageBackend& backend)
+{
+    char buf[kHeaderSize];
+    magic_ = 0;
+    if (backend.ReadAt(0, buf, sizeof(buf)) != sizeof(buf))
+        return false;
+
+    const char* p = buf;
+    p = load_integer(magic_, p);
+    p = load_integer(version_, p);
+    p = load_integer(chunk_size_, p);
+    p = load_integer(compress_, p);
+    p = load_integer(dedup_, p);
+    p = load_integer(tree_chunk_, p);
+    p = load_integer(tree_size_, p);
+    p = load_integer(log_chunk_, p);
+    p = load_integer(log_size_, p);
+    p = load_integer(chunks_amount_, p);
+    p = load_integer(bitmap_chunk_, p);
+    load_integer(bitmap_size_, p);
+
+    return magic_ == kStorageMagic && version_ == kStorageVersion && ValidChunkSize(chunk_size_);
+}
+
+
+void StorageHeader::Write(StorageBackend& backend)
+{
+    char buf[kHeaderSize];
+
+    char* p = buf;
+    p = store_integer(magic_, p);
+    p = store_integer(version_, p);
+    p = store_integer(chunk_size_, p);
+    p = store_integer(compress_, p);
+    p = store_integer(dedup_, p);
+    p = store_integer(tree_chunk_, p);
+    p = store_integer(tree_size_, p);
+    p = store_integer(log_chunk_, p);
+    p = store_integer(log_size_, p);
+    p = store_integer(chunks_amount_, p);
+    p = store_integer(bitmap_chunk_, p);
+    store_integer(bitmap_size_, p);
+
+    backend.WriteAt(0, buf, sizeof(buf));
+}
+
+
+void StorageHeader::WriteRefs(StorageBackend& backend)
+{
+    char buf[kChunksAmountPos - kTreeChunkPos];
+
+    char* p = buf;
+    p = store_integer(tree_chunk_, p);
+    p = store_integer(tree_size_, p);
+    p = store_integer(log_chunk_, p);
+    store_integer(log_size_, p);
+
+    backend.WriteAt(kTreeChunkPos, buf, sizeof(buf));
+}
+
+
+void StorageHeader::WriteBitmapRefs(StorageBackend& backend)
+{
+    char buf[kHeaderSize - kChunksAmountPos];
+
+    char* p = buf;
+    p = store_integer(chunks_amount_, p);
+    p = store_integer(bitmap_chunk_, p);
+    store_integer(bitmap_size_, p);
+
+    backend.WriteAt(kChunksAmountPos, buf, sizeof(buf));
+}
+
+
+}
@@ -0,0 +1,80 @@
+#include "vfs.h"
+
+
+namespace TestTask
+{
+
+using StorageBackend = VFS::StorageBackend;
+using StreamBackend = VFS::StreamBackend;
+using MmapBackend = VFS::MmapBackend;
+using PosixBackend = VFS::PosixBackend;
+
+
+unique_ptr<StorageBackend> StorageBackend::Open(const string& filename, StorageBackendType type)
+{
+    if (type == StorageBackendType::kMmap)
+        return std::make_unique<MmapBackend>(filename);
+
+    if (type == StorageBackendType::kPosix)
+        return std::make_unique<PosixBackend>(filename);
+
+    return std::make_unique<StreamBackend>(filename);
+}
+
+
+StreamBackend::StreamBackend(const string& filename)
+    : stream_(filename, std::ios::binary | std::ios::in | std::ios::out)
+{
+
+}
+
+
+bool StreamBackend::Valid() const
+{
+    return stream_.is_open();
+}
+
+
+size_t StreamBackend::ReadAt(uint64_t pos, char* buf, size_t len)
+{
+    lock_guard lock(m_);
+    stream_.clear();
+    stream_.seekg(pos);
+    stream_.read(buf, len);
+    size_t read = stream_.gcount();
+    stream_.clear();
+
+    return read;
+}
+
+
+size_t StreamBackend::WriteAt(uint64_t pos, const char* buf, size_t len)
+{
+    lock_guard lock(m_);
+    stream_.clear();
+    stream_.seekp(pos);
+    stream_.write(buf, len);
+
+    bool good = stream_.good();
+    stream_.clear();
+
+    return good ? len : 0;
+}
+
+
+uint64_t StreamBackend::Size()
+{
+    lock_guard lock(m_);
+    stream_.clear();
+    return stream_size(stream_);
+}
+
+
+void StreamBackend::Flush()
+{
+    lock_guard lock(m_);
+    stream_.flush();
+}
+
+
+}
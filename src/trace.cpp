@@ -0,0 +1,99 @@
+#include "trace.h"
+
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+
+namespace TestTask
+{
+
+
+TraceBuffer& TraceBuffer::Instance()
+{
+    static TraceBuffer buffer;
+    return buffer;
+}
+
+
+void TraceBuffer::Push(TraceCategory category, TraceLevel level, const std::string& text)
+{
+    uint64_t idx = head_.fetch_add(1, std::memory_order_relaxed);
+    auto& record = records_[idx % kCapacity];
+
+    // тот же слот мог достаться писателю на круг раньше или позже нас; слот пишет
+    // только один писатель, поэтому занятый или уже переписанный более новой записью
+    // слот пропускается вместе с нашей записью
+    uint64_t seq = record.seq_.load(std::memory_order_relaxed);
+    if (seq % 2 != 0 || seq > idx * 2 ||
+        !record.seq_.compare_exchange_strong(seq, idx * 2 + 1, std::memory_order_acquire, std::memory_order_relaxed))
+        return;
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    record.time_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+    record.level_ = level;
+    record.category_ = category;
+
+    size_t len = std::min(text.size(), kTextSize - 1);
+    std::memcpy(record.text_, text.data(), len);
+    record.text_[len] = '\0';
+
+    record.seq_.store(idx * 2 + 2, std::memory_order_release);
+}
+
+
+void TraceBuffer::Dump(std::ostream& os) const
+{
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t first = head > kCapacity ? head - kCapacity : 0;
+
+    for (uint64_t idx = first; idx < head; idx++)
+    {
+        auto& record = records_[idx % kCapacity];
+
+        if (record.seq_.load(std::memory_order_acquire) != idx * 2 + 2)
+            continue;
+
+        uint64_t time_ns = record.time_ns_;
+        auto level = record.level_;
+        auto category = record.category_;
+        char text[kTextSize];
+        std::memcpy(text, record.text_, kTextSize);
+
+        // если слот успели переписать, пока мы его копировали, запись пропускается
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (record.seq_.load(std::memory_order_relaxed) != idx * 2 + 2)
+            continue;
+
+        text[kTextSize - 1] = '\0';
+        os << time_ns << " [" << trace_category_name(category) << ":" << int(level) << "] " << text << "\n";
+    }
+}
+
+
+size_t TraceBuffer::Pushed() const
+{
+    return head_.load(std::memory_order_relaxed);
+}
+
+
+const char* trace_category_name(TraceCategory category)
+{
+    switch (category)
+    {
+    case TraceCategory::kTree:
+        return "tree";
+    case TraceCategory::kChunk:
+        return "chunk";
+    case TraceCategory::kAlloc:
+        return "alloc";
+    case TraceCategory::kIo:
+        return "io";
+    }
+
+    return "?";
+}
+
+
+}
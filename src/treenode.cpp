@@ -9,123 +9,83 @@ using TreeNode = FileTree::TreeNode;
 
 
 
-TreeNode::TreeNode(const string& name, uint16_t type): type_(type)
+TreeNode::TreeNode(FileTree::NameId name, uint16_t type, FileTree::NodeId parent)
+    : name_(name), parent_(parent), info_(FileNodeInfo())
 {
-    if (IsFile())
-        file_.name_ = name;
-    else
-        dir_.name_ = name;
-}
-
-
-TreeNode::TreeNode(uint16_t type): type_(type) 
-{
-
+    if (type == kDirectory)
+        info_ = DirectoryNodeInfo();
 }
 
 
 uint64_t TreeNode::CalcSize() const
 {
-    uint64_t size = sizeof(type_);
+    uint64_t size = sizeof(uint16_t);
 
     if (IsFile())
     {
-        size += sizeof(file_.first_chunk_);
-        size += sizeof(file_.content_size_);
-        size += file_.name_.size() + 1;
+        auto& file = FileInfo();
+        size += sizeof(file.first_chunk_);
+        size += sizeof(file.content_size_);
+        size += sizeof(name_);
+        size += sizeof(uint64_t);
+        size += file.extents_.size() * sizeof(FileExtent);
+        // полоса и длина встроенного содержимого; сами байты из extras_ добавляет FileTree::CalcSize
+        size += sizeof(FileStripe::index_) + sizeof(FileStripe::count_) + sizeof(FileStripe::unit_);
+        size += sizeof(uint32_t);
     }
     else if (IsDirectory())
     {
-        size += sizeof(dir_.subnodes_amount_);
-        size += dir_.name_.size() + 1;
-        size += dir_.subnodes_amount_ * sizeof(uint64_t);
+        size += sizeof(uint64_t);
+        size += sizeof(name_);
+        size += DirInfo().subnodes_.size() * sizeof(uint64_t);
     }
 
     return size;
 }
 
 
-bool TreeNode::Has(const string& name, uint16_t type) const
+uint16_t TreeNode::Type() const
 {
-    return bool(GetSubnodeByName(name, type));
+    return IsDirectory() ? kDirectory : kFile;
 }
 
 
-shared_ptr<TreeNode> TreeNode::GetSubnodeByName(const string& name, uint16_t type) const
+FileTree::NameId TreeNode::Name() const
 {
-    if (!IsDirectory())
-        return {};
-    
-    shared_ptr<TreeNode> sub;
+    return name_;
+}
 
-    for (auto& node : dir_.subnodes_)
-    {
-        // cout << "compare node->file_.name_='" << node->file_.name_ << "' \n" 
-        //      << "name='" << name << "'\n"
-        //      << "node->dir_.name_='" << node->dir_.name_ << "'\n"
-        //      << "type=" << type << "\n" 
-        //      << "node type=" << node->type_ << "\n"
-        //      << "node->file_.name_ == name = " << (node->file_.name_ == name) << "\n"
-        //      << "node->dir_.name_ == name = " << (node->dir_.name_ == name ) << "\n"
-        //      << endl;
-        
-        // cout << "CONDITION: \n"
-        //   << (type == kFile && node->IsFile() && node->file_.name_ == name)
-        //   << " || " 
-        //   << (type == kDirectory && node->IsDirectory() && node->dir_.name_ == name)  
-        //   << endl;
-        
-
-        // const string &s1 = node->dir_.name_;
-        // const string &s2 = name;
-
-        // cout << "s1='" << s1 << " " << s1.size()
-        //      << "' s2='" << s2 << " " << s2.size()
-        //      << "'  s1==s2=" << (s1==s2) 
-        //      << endl;
-
-        if ((type == kFile && node->IsFile() && node->file_.name_ == name) || 
-            (type == kDirectory && node->IsDirectory() && node->dir_.name_ == name))
-        {
-            // cout << "found sub: " << sub.get() << endl;
-            sub = node;
-            break;
-        }
-    }
 
-    return sub;
+bool TreeNode::IsFile() const
+{
+    return std::holds_alternative<FileNodeInfo>(info_);
+}
+
+bool TreeNode::IsDirectory() const
+{
+    return std::holds_alternative<DirectoryNodeInfo>(info_);
 }
 
 
-bool TreeNode::AppendSubnode(shared_ptr<TreeNode>&& sub)
+FileTree::FileNodeInfo& TreeNode::FileInfo()
 {
-    if (!IsDirectory())
-        return false;
-    
-    dir_.subnodes_.push_back(std::move(sub));
-    ++dir_.subnodes_amount_;
-    
-    return true;
+    return std::get<FileNodeInfo>(info_);
 }
 
-
-const std::string& TreeNode::Name() const
+const FileTree::FileNodeInfo& TreeNode::FileInfo() const
 {
-    if (IsFile())
-        return file_.name_;
-    else 
-        return dir_.name_;
+    return std::get<FileNodeInfo>(info_);
 }
 
 
-bool TreeNode::IsFile() const
+FileTree::DirectoryNodeInfo& TreeNode::DirInfo()
 {
-    return type_ == kFile;
+    return std::get<DirectoryNodeInfo>(info_);
 }
 
-bool TreeNode::IsDirectory() const
+const FileTree::DirectoryNodeInfo& TreeNode::DirInfo() const
 {
-    return type_ == kDirectory;
+    return std::get<DirectoryNodeInfo>(info_);
 }
 
 
@@ -135,23 +95,17 @@ void TreeNode::Print(std::ostream& os) const
     if (IsDirectory())
     {
         os << "directory; ";
-        os << dir_.name_ << "; ";
-        os << dir_.subnodes_amount_ << "; ";
-        
-        for (auto& sub : dir_.subnodes_)
-            os << sub->Name() << (sub->IsDirectory() ? "/" : sub->IsFile() ? "" : "?") << ",";
+        os << "#" << name_ << "; ";
+        os << DirInfo().subnodes_.size();
     }
-    else if(IsFile())
+    else
     {
+        auto& file = FileInfo();
         os << "file; ";
-        os << file_.content_size_ << "; ";
-        os << file_.first_chunk_ << "; ";
-        os << file_.name_;
+        os << file.content_size_ << "; ";
+        os << file.first_chunk_ << "; ";
+        os << "#" << name_;
     }
-    else
-    {
-        os << "type=" << type_;
-    } 
 
     os << "}";
 }
@@ -163,4 +117,4 @@ std::ostream& operator<<(std::ostream& os, const TreeNode& node)
 }
 
 
-}
\ No newline at end of file
+}
@@ -22,6 +22,51 @@ using std::string;
 using std::string_view;
 using std::fstream;
 using std::ofstream;
+using Metrics = VFS::Metrics;
+
+
+namespace
+{
+
+thread_local size_t operation_depth = 0;
+
+// время и объем одной операции IVFS, в метрики попадают при выходе из нее;
+// вложенные вызовы (Write через WriteV, обращения к полосам, работа пула потоков) не считаются,
+// чтобы каждая операция пользователя попадала в метрики ровно один раз
+struct OperationScope
+{
+    Metrics::OperationCounters& counters_;
+    size_t operation_;
+    bool counted_;
+    uint64_t bytes_ = 0;
+    std::chrono::steady_clock::time_point begin_ = std::chrono::steady_clock::now();
+
+    OperationScope(Metrics::OperationCounters& counters, size_t operation)
+        : counters_(counters), operation_(operation), counted_(operation_depth++ == 0 && !VFS::IoPool::InWorker())
+    {
+    }
+
+    ~OperationScope()
+    {
+        --operation_depth;
+        if (!counted_)
+            return;
+
+        auto elapsed = std::chrono::steady_clock::now() - begin_;
+        size_t base = operation_ * Metrics::kOperationFields;
+        counters_.Add(base + Metrics::kCalls);
+        counters_.Add(base + Metrics::kBytes, bytes_);
+        counters_.Add(base + Metrics::kNanos, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+    size_t Bytes(size_t bytes)
+    {
+        bytes_ = bytes;
+        return bytes;
+    }
+};
+
+}
 
 
 VFS* VFS::Instance()
@@ -38,17 +83,65 @@ VFS::VFS(initializer_list<string> storage_filenames)
 
 bool VFS::AddStorageFile(const string& filename)
 {
-    StorageFile file(filename);
-    if (!file.Valid())
+    return AddStorageFile(filename, storage_backend_);
+}
+
+bool VFS::AddStorageFile(const string& filename, StorageBackendType backend_type)
+{
+    return OpenStorageFile(filename, backend_type);
+}
+
+bool VFS::OpenStorageFile(const string& filename, StorageBackendType backend_type, size_t* storage)
+{
+    StorageFormat format;
+    {
+        shared_lock lock(m_);
+        format = storage_format_;
+    }
+
+    // чтение или разметка контейнера идут без m_, под ней он только добавляется в список
+    auto sfile = std::make_unique<StorageFile>(filename, backend_type, chunk_cache_, format);
+    if (!sfile->Valid())
     {
         std::cerr << "invalid storage file " << __FILE__ << ":" << __LINE__ << std::endl;
         return false;
     }
 
-    storage_files_.push_back(std::move(file));  
+    unique_lock lock(m_);
+    sfile->SetSizeLimit(storage_file_size_limit_);
+    if (storage)
+        *storage = storage_files_.size();
+    storage_files_.push_back(std::move(sfile));
     return true;
 }
 
+VFS::StorageFile& VFS::GetStorageFile(size_t storage)
+{
+    shared_lock lock(m_);
+    return *storage_files_[storage];
+}
+
+size_t VFS::StorageCount()
+{
+    shared_lock lock(m_);
+    return storage_files_.size();
+}
+
+void VFS::SetStorageBackend(StorageBackendType backend_type)
+{
+    storage_backend_ = backend_type;
+}
+
+void VFS::SetChunkCacheSize(size_t pages)
+{
+    chunk_cache_->SetCapacity(pages);
+}
+
+VFS::ChunkCache::Stats VFS::GetChunkCacheStats()
+{
+    return chunk_cache_->GetStats();
+}
+
 void VFS::SetStorageFileFilenamePrefix(const string& prefix)
 {
     storage_filename_prefix_ = prefix;
@@ -58,82 +151,181 @@ bool VFS::SetStorageFileSizeLimit(size_t size)
 {
     if (size < kMinimumStorageFileSize)
         return false;
+
+    unique_lock lock(m_);
     storage_file_size_limit_ = size;
+    for (auto& sfile : storage_files_)
+        sfile->SetSizeLimit(size);
     return true;
 }
 
-bool VFS::CreateNewStorageFile()
+bool VFS::SetChunkSize(size_t size)
 {
-    size_t i = 0;
-    while (std::filesystem::exists(storage_filename_prefix_ + std::to_string(i)))
-        i++;
+    unique_lock lock(m_);
+    if (!ValidChunkSize(size))
+        return false;
+    storage_format_.chunk_size_ = size;
+    return true;
+}
 
-    string filename = storage_filename_prefix_ + std::to_string(i);
-    
-    ofstream file(filename);
-    file.close();
-    // return file.good();
-    return AddStorageFile(filename);  // ???
+void VFS::SetCompression(bool enabled)
+{
+    unique_lock lock(m_);
+    storage_format_.compress_ = enabled;
 }
 
-void VFS::test2()
+void VFS::SetDedup(bool enabled)
 {
-    storage_files_[0].CreateEmptyFile("biba/vvvv.c++");
-    return;
+    unique_lock lock(m_);
+    storage_format_.dedup_ = enabled;
+}
 
-    // CreateNewStorageFile();
-    cout << "storage filename: " << storage_files_[0].filename_ << endl;
-    cout << "storage file valid: " << storage_files_[0].Valid() << endl;
+void VFS::SetStriping(size_t count, size_t unit)
+{
+    unique_lock lock(m_);
+    stripe_count_ = std::max<size_t>(count, 1);
+    // куски полос кратны полезной части чанка новых контейнеров, чтобы не делить чанки между полосами
+    size_t payload = storage_format_.chunk_size_ - kChunkHeaderSize;
+    unit = std::max<size_t>(unit, payload);
+    stripe_unit_ = unit / payload * payload;
+}
 
-    string path = "biba/aboba.txt";
-    auto& sfile = storage_files_[0];
+void VFS::SetPlacementPolicy(PlacementPolicy policy)
+{
+    unique_lock lock(m_);
+    placement_policy_ = policy;
+}
 
-    sfile.tree_.Print(cout);
+void VFS::SetInlineThreshold(size_t bytes)
+{
+    unique_lock lock(m_);
+    inline_threshold_ = bytes;
+}
 
-    auto free_chunk = sfile.FindFreeChunk();
-    cout << "after FindFreeChunk stream good: " << sfile.stream_.good() << endl;
-    cout << "found free chunk: " << free_chunk << endl;
+vector<VFS::StorageStats> VFS::GetStorageStats()
+{
+    shared_lock lock(m_);
 
-    bool actually_added = sfile.tree_.AddFile(path, free_chunk);
-    cout << "actually_added: " << actually_added << endl;
-    
+    vector<StorageStats> stats;
+    for (auto& sfile : storage_files_)
+        stats.push_back(StorageStats{ sfile->filename_, sfile->GetUsage(storage_file_size_limit_) });
+
+    return stats;
+}
+
+Metrics::Snapshot VFS::GetMetrics()
+{
+    shared_lock lock(m_);
+
+    Metrics::Snapshot snapshot;
+    snapshot.operations_ = op_metrics_.Sum();
+    for (auto& sfile : storage_files_)
+        snapshot.storages_.push_back({ sfile->filename_, sfile->metrics_.Sum() });
+
+    return snapshot;
+}
+
+void VFS::SetIoThreads(size_t threads)
+{
+    lock_guard lock(io_pool_m_);
+    io_threads_ = std::max<size_t>(threads, 1);
+    // старый пул доделывает свои операции, новый создастся при следующем вызове
+    io_pool_.reset();
+}
+
+future<size_t> VFS::ReadAsync(File* f, char* buff, size_t len)
+{
+    auto result = make_shared<promise<size_t>>();
+    auto ready = result->get_future();
+    ReadAsync(f, buff, len, [result](size_t read) { result->set_value(read); });
+    return ready;
+}
+
+future<size_t> VFS::WriteAsync(File* f, const char* buff, size_t len)
+{
+    auto result = make_shared<promise<size_t>>();
+    auto ready = result->get_future();
+    WriteAsync(f, buff, len, [result](size_t written) { result->set_value(written); });
+    return ready;
+}
+
+void VFS::ReadAsync(File* f, char* buff, size_t len, IoPool::Callback done)
+{
+    IoPool::Request request;
+    request.file_ = f;
+    request.read_buf_ = buff;
+    request.len_ = len;
+    request.done_ = std::move(done);
+    SubmitIo(f, std::move(request));
+}
+
+void VFS::WriteAsync(File* f, const char* buff, size_t len, IoPool::Callback done)
+{
+    IoPool::Request request;
+    request.file_ = f;
+    request.write_ = true;
+    request.write_buf_ = buff;
+    request.len_ = len;
+    request.done_ = std::move(done);
+    SubmitIo(f, std::move(request));
+}
 
-    if (!actually_added)
+void VFS::SubmitIo(File* f, IoPool::Request&& request)
+{
+    if (!f)
     {
-        cout << "FILE EXISTS" << endl;
-        // return;
+        if (request.done_)
+            request.done_(0);
+        return;
     }
-    else
-    {
-        bool should_shift_file_chunks = ToChunks(sfile.tree_.CalcSize()) > ToChunks(sfile.tree_.tree_size_);
-        cout << "should_shift_file_chunks: " << should_shift_file_chunks << endl;
 
-        cout << "before shift stream good: " << sfile.stream_.good() << endl;
-        if (should_shift_file_chunks)
-        {
-            sfile.tree_.ShiftFileChunks(kChunkSize);
-            sfile.ShiftChunks(ToBytes(ToChunks(sfile.tree_.CalcSize())));
+    lock_guard lock(io_pool_m_);
+    if (!io_pool_)
+        io_pool_ = std::make_unique<IoPool>(*this, io_threads_);
+    io_pool_->Submit(f->storage_, std::move(request));
+}
 
-            free_chunk += kChunkSize;
-        }
+void VFS::SubmitTask(function<void()> task)
+{
+    IoPool::Request request;
+    request.task_ = std::move(task);
 
-        ChunkHeader header;
-        header.Write(sfile.stream_, free_chunk);
-        
-        cout << "before wrote stream good: " << sfile.stream_.good() << endl;
-        sfile.tree_.Write(sfile.stream_);
-        cout << "tree wrote stream good: " << sfile.stream_.good() << endl;
-    }
+    lock_guard lock(io_pool_m_);
+    if (!io_pool_)
+        io_pool_ = std::make_unique<IoPool>(*this, io_threads_);
+    io_pool_->Submit(IoPool::kTaskQueue, std::move(request));
+}
+
+bool VFS::CreateNewStorageFile(size_t* storage)
+{
+    lock_guard lock(create_storage_m_);
+    return CreateStorageFileUnlocked(storage);
+}
 
+bool VFS::CreateStorageFileUnlocked(size_t* storage)
+{
+    size_t i = 0;
+    while (std::filesystem::exists(storage_filename_prefix_ + std::to_string(i)))
+        i++;
+
+    string filename = storage_filename_prefix_ + std::to_string(i);
+    
+    ofstream file(filename);
+    file.close();
+    // return file.good();
+    return OpenStorageFile(filename, storage_backend_, storage);
+}
+
+void VFS::test2()
+{
+    storage_files_[0]->CreateEmptyFile("biba/vvvv.c++");
 }
 
 
 // 1. получить свободный чанк
 // 2. создать запись в дереве
-// 3. сдвинуть адреса в дереве если нет места для дерева
-// 4. сдвинуть все чанки если нет места для дерева
-// 5. записать дерево 
-// 6. записать в чанк, что он занят
+// 3. записать в чанк, что он занят
+// 4. дописать запись о файле в журнал дерева (дерево целиком пишется только в контрольной точке)
 
 
 void VFS::test()
@@ -142,48 +334,25 @@ void VFS::test()
     // return;
 
 
-    cout << "name: " << storage_files_[0].filename_ << endl;
-    cout << "good: " << storage_files_[0].stream_.good() << endl;
+    cout << "name: " << storage_files_[0]->filename_ << endl;
+    cout << "good: " << storage_files_[0]->Valid() << endl;
 
     using TreeNode = FileTree::TreeNode;
 
     auto tree = FileTree();
-    tree.root_ = std::make_shared<TreeNode>(TreeNode::kDirectory);
-    tree.root_->dir_.name_ = "aads";
+    tree.InitializeEmptyTree();
+    tree.Node(tree.root_).name_ = tree.names_.Intern("aads");
   
 
 
-    auto task1_cpp = std::make_shared<TreeNode>("task1.cpp", TreeNode::kFile);
-    auto task2_cpp = std::make_shared<TreeNode>("task2.cpp", TreeNode::kFile);
-    auto task3_cpp = std::make_shared<TreeNode>("task3.cpp", TreeNode::kFile);
-    auto a_py = std::make_shared<TreeNode>("a.py", TreeNode::kFile);
-    
-    auto rk1_dir = std::make_shared<TreeNode>("rk1", TreeNode::kDirectory);
-    rk1_dir->AppendSubnode(std::move(task2_cpp));
-    rk1_dir->AppendSubnode(std::move(task3_cpp));
-    
-    auto mod1_dir = std::make_shared<TreeNode>("mod1", TreeNode::kDirectory);
-    mod1_dir->AppendSubnode(std::move(a_py));
-    mod1_dir->AppendSubnode(std::move(task1_cpp));
-    mod1_dir->AppendSubnode(std::move(rk1_dir));
-    
-
-    auto app_exe = std::make_shared<TreeNode>("app.exe", TreeNode::kFile);
-    auto task5_cpp = std::make_shared<TreeNode>("task5.cpp", TreeNode::kFile);
-    
-    auto rk2_dir = std::make_shared<TreeNode>("rk2", TreeNode::kDirectory);
-    rk2_dir->AppendSubnode(std::move(app_exe));
-    
-    auto aboba_dir = std::make_shared<TreeNode>("aboba", TreeNode::kDirectory);
-    
-    auto mod2_dir = std::make_shared<TreeNode>("mod2", TreeNode::kDirectory);
-    mod2_dir->AppendSubnode(std::move(rk2_dir));
-    mod2_dir->AppendSubnode(std::move(task5_cpp));
-    mod2_dir->AppendSubnode(std::move(aboba_dir));
+    tree.AddFile("mod1/rk1/task2.cpp");
+    tree.AddFile("mod1/rk1/task3.cpp");
+    tree.AddFile("mod1/a.py");
+    tree.AddFile("mod1/task1.cpp");
 
-    tree.root_->AppendSubnode(std::move(mod1_dir));
-    tree.root_->AppendSubnode(std::move(mod2_dir));
-    tree.root_->dir_.subnodes_amount_ = tree.root_->dir_.subnodes_.size();
+    tree.AddFile("mod2/rk2/app.exe");
+    tree.AddFile("mod2/task5.cpp");
+    tree.GetNode("mod2/aboba", TreeNode::kDirectory, true);
 
 
     cout << "actually added dodo/igolki/22.txt: " << tree.AddFile("dodo/igolki/22.txt") << endl;
@@ -194,76 +363,789 @@ void VFS::test()
     cout << "actually added mod2/aboba/ffffile: " << tree.AddFile("mod2/aboba/ffffile") << endl;
     cout << "actually added mod1/rk1/task4.cpp: " << tree.AddFile("mod1/rk1/task4.cpp") << endl;
 
-    tree.Write(storage_files_[0].stream_);
+    BinaryWriter writer;
+    tree.Write(writer);
 
-    cout << "stream tellg: " << storage_files_[0].stream_.tellg() << endl;
-    cout << "stream tellp: " << storage_files_[0].stream_.tellp() << endl;
+    cout << "tree bytes: " << writer.Tell() << endl;
 
-    storage_files_[0].stream_.seekg(0);
     auto read_tree = FileTree();
 
-    read_tree.Read(storage_files_[0].stream_);
+    read_tree.Read(writer.Take());
+    read_tree.LoadAll();
     read_tree.Print(cout);
+
+
+    // сжатие должно возвращать исходные байты на пустых, несжимаемых и повторяющихся данных
+    auto round_trip = [](const string& data, size_t capacity)
+    {
+        string packed(capacity, '\0');
+        size_t stored = ChunkCodec::Compress(data.data(), data.size(), packed.data(), capacity);
+
+        string unpacked(data.size(), '\0');
+        return stored != 0 && ChunkCodec::Decompress(packed.data(), stored, unpacked.data(), unpacked.size())
+            && unpacked == data;
+    };
+
+    string noise(kDefaultChunkPayloadSize, '\0');
+    uint32_t seed = 1;
+    for (auto& c : noise)
+    {
+        seed = seed * 1664525 + 1013904223;
+        c = char(seed >> 24);
+    }
+
+    string repeated;
+    while (repeated.size() < kDefaultChunkPayloadSize)
+        repeated += "mod1/rk1/task2.cpp ";
+    repeated.resize(kDefaultChunkPayloadSize);
+
+    cout << "codec empty: " << round_trip(string(), 16) << endl;
+    cout << "codec noise: " << round_trip(noise, noise.size() + noise.size() / 255 + 16) << endl;
+    string shorter(noise.size() - 1, '\0');
+    cout << "codec noise does not shrink: " << (ChunkCodec::Compress(noise.data(), noise.size(), shorter.data(), shorter.size()) == 0) << endl;
+    cout << "codec repeated: " << round_trip(repeated, repeated.size() - 1) << endl;
+
+    // несжимаемый чанк ложится как есть, повторяющийся - сжатым; контейнер со сжатием
+    // отдельный и временный, формат следующих контейнеров VFS не меняется
+    StorageFormat packed_format = storage_format_;
+    packed_format.compress_ = true;
+    string packed_name = storage_filename_prefix_ + "packed-test";
+    ofstream(packed_name).close();
+
+    {
+        StorageFile sfile(packed_name, storage_backend_, nullptr, packed_format);
+        uint64_t pos = sfile.AllocateChunk();
+        string buf;
+        string back;
+        ChunkHeader header;
+
+        sfile.WriteChunk(pos, noise, buf);
+        header.Read(*sfile.backend_, pos);
+        cout << "chunk noise stored raw: " << (!header.Compressed() && sfile.ReadChunk(pos, noise.size(), back) && back == noise) << endl;
+
+        sfile.WriteChunk(pos, repeated, buf);
+        header.Read(*sfile.backend_, pos);
+        cout << "chunk repeated compressed: " << (header.Compressed() && sfile.ReadChunk(pos, repeated.size(), back) && back == repeated) << endl;
+    }
+
+    std::filesystem::remove(packed_name);
 }
 
 
-size_t VFS::ToChunks(size_t bytes)
+bool VFS::ValidChunkSize(size_t size)
 {
-    return bytes / kChunkSize + (bytes % kChunkSize == 0 ? 0 : 1);
+    return size >= kMinChunkSize && size <= kMaxChunkSize && (size & (size - 1)) == 0;
 }
 
 
-size_t VFS::ToBytes(size_t chunks)
+
+string VFS::NormalizePath(const string& path)
 {
-    return chunks * kChunkSize;
+    string normalized;
+
+    for (auto& part : split_string(path, kPathDelimeter))
+    {
+        if (!normalized.empty())
+            normalized += kPathDelimeter;
+        normalized += part;
+    }
+
+    return normalized;
 }
 
 
+bool VFS::LookupPath(const string& path, CachedPath& found)
+{
+    // попадание в кэш - только чтение; устаревшая запись перезаписывается или стирается ниже
+    bool stale = false;
+    {
+        shared_lock lock(m_);
+        auto it = path_cache_.find(path);
+        if (it != path_cache_.end())
+        {
+            if (it->second.generation_ == storage_files_[it->second.storage_]->generation_)
+            {
+                found = it->second;
+                return true;
+            }
 
-File* VFS::Open( const char *name )
+            stale = true;
+        }
+    }
+
+    size_t count = StorageCount();
+    for (size_t i = 0; i < count; i++)
+    {
+        auto& sfile = GetStorageFile(i);
+        auto node = sfile.FindFile(path);
+        if (node != FileTree::kNoNode)
+        {
+            found = CachedPath{ i, sfile.generation_, node };
+            unique_lock lock(m_);
+            path_cache_[path] = found;
+            return true;
+        }
+    }
+
+    if (stale)
+    {
+        unique_lock lock(m_);
+        path_cache_.erase(path);
+    }
+
+    return false;
+}
+
+
+void VFS::CachePath(const string& path, size_t storage)
 {
-    File* file = nullptr;
-    string str_name = name;
+    auto& sfile = GetStorageFile(storage);
+    auto node = sfile.FindFile(path);
 
-    auto it = opened_files_.find(str_name);
-    if (it != opened_files_.end())
+    unique_lock lock(m_);
+    if (node != FileTree::kNoNode)
+        path_cache_[path] = CachedPath{ storage, sfile.generation_, node };
+    else
+        path_cache_.erase(path);
+}
+
+
+VFS::StorageFile* VFS::PickStorageFile(size_t& storage, const string& path)
+{
+    size_t slash = path.rfind(kPathDelimeter);
+    string dir = slash == string::npos ? string() : path.substr(0, slash);
+
+    PlacementPolicy policy;
     {
-        
+        shared_lock lock(m_);
+        policy = placement_policy_;
     }
 
-    for (auto& sfile : storage_files_)
+    size_t count = StorageCount();
+    size_t best = count;
+    size_t best_fill = 0;
+    // почти заполненный контейнер оставляет место под рост своих файлов,
+    // новый файл попадает в него, только если завести другой контейнер не вышло
+    size_t fallback = count;
+
+    for (size_t i = 0; i < count; i++)
     {
-        if (sfile.HasFile(str_name))
+        auto& sfile = GetStorageFile(i);
+        auto usage = sfile.GetUsage(storage_file_size_limit_);
+        if (usage.free_chunks_ == 0)
+            continue;
+
+        if (usage.fill_percent_ >= kRolloverFillPercent)
+        {
+            if (fallback == count)
+                fallback = i;
+            continue;
+        }
+
+        if (policy == PlacementPolicy::kFirstFit)
         {
+            best = i;
+            break;
+        }
 
+        // соседи по папке кладутся в один контейнер, пока он не подошел к лимиту
+        if (policy == PlacementPolicy::kParentLocality && !dir.empty() && sfile.HasDirectory(dir))
+        {
+            best = i;
             break;
         }
+
+        if (best == count || usage.fill_percent_ < best_fill)
+        {
+            best = i;
+            best_fill = usage.fill_percent_;
+        }
+    }
+
+    if (best == count && !CreateNewStorageFile(&best))
+    {
+        if (fallback == count)
+            return nullptr;
+        best = fallback;
+    }
+
+    storage = best;
+    return &GetStorageFile(best);
+}
+
+
+void VFS::EnsureSpareStorage()
+{
+    // Create и Close не ждут создания контейнера; пока задача в очереди, вторая не ставится
+    if (spare_pending_.exchange(true))
+        return;
+
+    SubmitTask([this]
+    {
+        spare_pending_ = false;
+        CreateSpareStorage();
+    });
+}
+
+
+void VFS::CreateSpareStorage()
+{
+    // проверка под той же блокировкой, что и создание, иначе параллельные задачи
+    // заведут по запасному контейнеру каждая
+    lock_guard lock(create_storage_m_);
+
+    size_t count = StorageCount();
+    if (count == 0)
+        return;
+
+    for (size_t i = 0; i < count; i++)
+        if (GetStorageFile(i).GetUsage(storage_file_size_limit_).fill_percent_ < kRolloverFillPercent)
+            return;
+
+    CreateStorageFileUnlocked(nullptr);
+}
+
+
+File* VFS::Open( const char *name )
+{
+    OperationScope scope(op_metrics_, Metrics::kOpen);
+    string path = NormalizePath(name);
+
+    {
+        unique_lock lock(m_);
+        auto it = opened_files_.find(path);
+        if (it != opened_files_.end())
+            return OpenDescriptor(it->second, path, FileMode::kReadOnly);
     }
 
+    CachedPath found;
+    vector<CachedPath> stripes;
+    if (!LookupPath(path, found) || !FindStripes(path, found, stripes))
+        return nullptr;
+
+    unique_lock lock(m_);
+    // пока шел поиск, путь мог открыть кто-то еще - тогда используется его описатель
+    auto [it, inserted] = opened_files_.try_emplace(path);
+    if (inserted)
+    {
+        it->second.node_ = found.node_;
+        it->second.storage_ = found.storage_;
+        it->second.stripes_ = std::move(stripes);
+    }
+
+    File* file = OpenDescriptor(it->second, path, FileMode::kReadOnly);
+    if (!file && inserted)
+        opened_files_.erase(it);
 
     return file;
 }
 
+
 File* VFS::Create( const char *name )
 {
-    return nullptr;
+    OperationScope scope(op_metrics_, Metrics::kCreate);
+    string path = NormalizePath(name);
+
+    if (path.empty())
+        return nullptr;
+
+    size_t stripe_count = 1;
+    {
+        unique_lock lock(m_);
+        auto it = opened_files_.find(path);
+        if (it != opened_files_.end())
+            return OpenDescriptor(it->second, path, FileMode::kWriteOnly);
+
+        // путь занимается сразу: пока файл создается или очищается без m_,
+        // Open и Create того же пути получают отказ, как при открытом писателе
+        opened_files_[path].mode_ = FileMode::kWriteOnly;
+        stripe_count = stripe_count_;
+    }
+
+    CachedPath found;
+    vector<CachedPath> stripes;
+    bool ready = CreateOrTruncate(path, stripe_count, found, stripes);
+    if (ready)
+        EnsureSpareStorage();
+
+    unique_lock lock(m_);
+    auto it = opened_files_.find(path);
+    if (!ready)
+    {
+        opened_files_.erase(it);
+        return nullptr;
+    }
+
+    auto& descriptor = it->second;
+    descriptor.node_ = found.node_;
+    descriptor.storage_ = found.storage_;
+    descriptor.stripes_ = std::move(stripes);
+    descriptor.mode_ = FileMode::kInvalid;
+
+    File* file = OpenDescriptor(descriptor, path, FileMode::kWriteOnly);
+    if (!file)
+        opened_files_.erase(it);
+
+    return file;
+}
+
+
+bool VFS::CreateOrTruncate(const string& path, size_t stripe_count, CachedPath& found, vector<CachedPath>& stripes)
+{
+    if (!LookupPath(path, found))
+    {
+        if (stripe_count > 1)
+        {
+            if (!CreateStriped(path))
+                return false;
+        }
+        else
+        {
+            size_t storage = 0;
+            auto* sfile = PickStorageFile(storage, path);
+            if (!sfile || !sfile->CreateEmptyFile(path))
+                return false;
+
+            CachePath(path, storage);
+        }
+
+        return LookupPath(path, found) && FindStripes(path, found, stripes);
+    }
+
+    if (!FindStripes(path, found, stripes))
+        return false;
+
+    if (stripes.empty() && !GetStorageFile(found.storage_).ClearFile(path))
+        return false;
+
+    for (auto& stripe : stripes)
+        if (!GetStorageFile(stripe.storage_).ClearFile(path))
+            return false;
+
+    return true;
+}
+
+
+File* VFS::OpenDescriptor(FileDescriptor& descriptor, const string& path, FileMode mode)
+{
+    // путь занят еще не созданным файлом
+    if (descriptor.node_ == FileTree::kNoNode)
+        return nullptr;
+
+    FileTree::FileSnapshot info;
+    if (!storage_files_[descriptor.storage_]->GetFileInfo(descriptor.node_, info))
+        return nullptr;
+
+    vector<FileTree::FileSnapshot> stripes(descriptor.stripes_.size());
+    for (size_t i = 0; i < stripes.size(); i++)
+    {
+        auto& stripe = descriptor.stripes_[i];
+        if (!storage_files_[stripe.storage_]->GetFileInfo(stripe.node_, stripes[i]))
+            return nullptr;
+    }
+
+    File* file = descriptor.GetFile(mode, info, stripes);
+    if (!file)
+        return nullptr;
+
+    file->path_ = path;
+    file->storage_ = descriptor.storage_;
+    file->inline_limit_ = std::min(inline_threshold_, storage_files_[file->storage_]->inline_cap_);
+    for (auto* part : file->stripes_)
+    {
+        part->path_ = path;
+        part->inline_limit_ = std::min(inline_threshold_, storage_files_[part->storage_]->inline_cap_);
+    }
+
+    return file;
+}
+
+
+bool VFS::FindStripes(const string& path, const CachedPath& found, vector<CachedPath>& stripes)
+{
+    stripes.clear();
+
+    FileTree::FileSnapshot info;
+    if (!GetStorageFile(found.storage_).GetFileInfo(found.node_, info))
+        return false;
+
+    const auto& stripe = info.stripe_;
+    if (stripe.count_ <= 1)
+        return true;
+
+    // остальные полосы лежат под тем же путем в других контейнерах
+    stripes.resize(stripe.count_);
+    size_t count = StorageCount();
+    for (size_t i = 0; i < count; i++)
+    {
+        auto& sfile = GetStorageFile(i);
+        auto node = i == found.storage_ ? found.node_ : sfile.FindFile(path);
+        FileTree::FileSnapshot other_info;
+        if (node == FileTree::kNoNode || !sfile.GetFileInfo(node, other_info))
+            continue;
+
+        const auto& other = other_info.stripe_;
+        if (other.count_ == stripe.count_ && other.unit_ == stripe.unit_ && other.index_ < stripe.count_)
+            stripes[other.index_] = CachedPath{ i, sfile.generation_, node };
+    }
+
+    for (auto& part : stripes)
+    {
+        if (part.node_ == FileTree::kNoNode)
+        {
+            stripes.clear();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool VFS::CreateStriped(const string& path)
+{
+    size_t stripe_count;
+    size_t stripe_unit;
+    {
+        shared_lock lock(m_);
+        stripe_count = stripe_count_;
+        stripe_unit = stripe_unit_;
+    }
+
+    size_t first = 0;
+    if (!PickStorageFile(first, path))
+        return false;
+
+    // остальные полосы - в наименее заполненные контейнеры
+    vector<std::pair<size_t, size_t>> candidates;
+    size_t count = StorageCount();
+    for (size_t i = 0; i < count; i++)
+    {
+        auto usage = GetStorageFile(i).GetUsage(storage_file_size_limit_);
+        if (i != first && usage.free_chunks_ > 0)
+            candidates.emplace_back(usage.fill_percent_, i);
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    vector<size_t> chosen{ first };
+    for (size_t i = 0; i < candidates.size() && chosen.size() < stripe_count; i++)
+        chosen.push_back(candidates[i].second);
+
+    size_t created = 0;
+    while (chosen.size() < stripe_count && CreateNewStorageFile(&created))
+        chosen.push_back(created);
+
+    FileStripe stripe;
+    stripe.count_ = uint32_t(chosen.size());
+    stripe.unit_ = stripe.count_ > 1 ? stripe_unit : 0;
+
+    for (size_t i = 0; i < chosen.size(); i++)
+    {
+        stripe.index_ = uint32_t(i);
+        if (GetStorageFile(chosen[i]).CreateEmptyFile(path, stripe))
+            continue;
+
+        // уже созданные полосы без остальных не открыть, а путь они бы заняли
+        for (size_t j = 0; j < i; j++)
+            GetStorageFile(chosen[j]).RemoveEmptyFile(path);
+        return false;
+    }
+
+    CachePath(path, first);
+    return true;
+}
+
+
+size_t VFS::ReadStriped(File& f, char* buff, size_t len)
+{
+    struct Piece
+    {
+        File* part_;
+        uint64_t part_pos_;
+        char* buf_;
+        size_t len_;
+    };
+
+    uint64_t unit = f.stripe_unit_;
+    uint64_t row = unit * f.stripes_.size();
+    len = std::min<uint64_t>(len, f.size_ > f.pos_ ? f.size_ - f.pos_ : 0);
+
+    vector<Piece> pieces;
+    for (size_t done = 0; done < len;)
+    {
+        uint64_t pos = f.pos_ + done;
+        size_t piece = std::min<uint64_t>(unit - pos % unit, len - done);
+        pieces.push_back({ f.stripes_[pos % row / unit], pos / row * unit + pos % unit, buff + done, piece });
+        done += piece;
+    }
+
+    // внутри каждой полосы куски идут подряд, так что ее позицию достаточно выставить один раз
+    for (auto* part : f.stripes_)
+    {
+        for (auto& piece : pieces)
+        {
+            if (piece.part_ != part)
+                continue;
+            if (Tell(part) != piece.part_pos_ && !Seek(part, piece.part_pos_))
+                return 0;
+            break;
+        }
+    }
+
+    // полосы читаются здесь же, а не через пул: вызывающий держит f.m_, и поток пула,
+    // занятый ReadAsync этого же файла, ждал бы его, а куски полос стояли бы за ним в очереди
+    vector<size_t> got(pieces.size());
+    for (size_t i = 0; i < pieces.size(); i++)
+        got[i] = Read(pieces[i].part_, pieces[i].buf_, pieces[i].len_);
+
+    size_t read = 0;
+    for (size_t i = 0; i < pieces.size() && got[i] == pieces[i].len_; i++)
+        read += got[i];
+
+    f.pos_ += read;
+    return read;
+}
+
+
+size_t VFS::WriteStriped(File& f, const iovec* iov, size_t count)
+{
+    struct Piece
+    {
+        File* part_;
+        uint64_t part_pos_;
+        const char* buf_;
+        size_t len_;
+    };
+
+    uint64_t unit = f.stripe_unit_;
+    uint64_t row = unit * f.stripes_.size();
+
+    vector<Piece> pieces;
+    uint64_t pos = f.pos_;
+    for (size_t i = 0; i < count; i++)
+    {
+        const char* src = static_cast<const char*>(iov[i].iov_base);
+        for (size_t done = 0; done < iov[i].iov_len;)
+        {
+            size_t piece = std::min<uint64_t>(unit - pos % unit, iov[i].iov_len - done);
+            pieces.push_back({ f.stripes_[pos % row / unit], pos / row * unit + pos % unit, src + done, piece });
+            done += piece;
+            pos += piece;
+        }
+    }
+
+    for (auto* part : f.stripes_)
+    {
+        for (auto& piece : pieces)
+        {
+            if (piece.part_ != part)
+                continue;
+            if (Tell(part) != piece.part_pos_ && !Seek(part, piece.part_pos_))
+                return 0;
+            break;
+        }
+    }
+
+    // как и в ReadStriped, без пула: его поток может ждать f.m_, который держит вызывающий
+    vector<size_t> put(pieces.size());
+    for (size_t i = 0; i < pieces.size(); i++)
+    {
+        iovec part_iov{ const_cast<char*>(pieces[i].buf_), pieces[i].len_ };
+        put[i] = WriteV(pieces[i].part_, &part_iov, 1);
+    }
+
+    size_t written = 0;
+    for (size_t i = 0; i < pieces.size() && put[i] == pieces[i].len_; i++)
+        written += put[i];
+
+    f.pos_ += written;
+    f.size_ = std::max(f.size_, f.pos_);
+    return written;
 }
 
 size_t VFS::Read( File *f, char *buff, size_t len )
 {
-    return 0;
+    OperationScope scope(op_metrics_, Metrics::kRead);
+
+    if (!f || !buff || f->mode_ != FileMode::kReadOnly)
+        return 0;
+
+    lock_guard lock(f->m_);
+    if (!f->stripes_.empty())
+        return scope.Bytes(ReadStriped(*f, buff, len));
+    return scope.Bytes(GetStorageFile(f->storage_).ReadFile(*f, buff, len));
 }
 
 size_t VFS::Write( File *f, char *buff, size_t len )
 {
-    return 0;
+    OperationScope scope(op_metrics_, Metrics::kWrite);
+
+    if (!f || !buff || f->mode_ != FileMode::kWriteOnly)
+        return 0;
+
+    iovec iov{ buff, len };
+    return scope.Bytes(WriteV(f, &iov, 1));
+}
+
+size_t VFS::WriteV( File *f, const iovec *iov, size_t count )
+{
+    OperationScope scope(op_metrics_, Metrics::kWriteV);
+
+    if (!f || (!iov && count > 0) || f->mode_ != FileMode::kWriteOnly)
+        return 0;
+
+    lock_guard lock(f->m_);
+    if (!f->stripes_.empty())
+        return scope.Bytes(WriteStriped(*f, iov, count));
+    return scope.Bytes(GetStorageFile(f->storage_).AppendFile(*f, iov, count));
+}
+
+size_t VFS::WriteBatch( File *const *files, const iovec *iov, size_t count )
+{
+    OperationScope scope(op_metrics_, Metrics::kWriteBatch);
+
+    if (!files || !iov)
+        return 0;
+
+    // записи в один и тот же файл собираются вместе в исходном порядке
+    map<File*, vector<iovec>> batches;
+    vector<File*> order;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        auto& batch = batches[files[i]];
+        if (batch.empty())
+            order.push_back(files[i]);
+        batch.push_back(iov[i]);
+    }
+
+    size_t written = 0;
+    for (auto* f : order)
+        written += WriteV(f, batches[f].data(), batches[f].size());
+
+    return scope.Bytes(written);
+}
+
+bool VFS::Seek( File *f, uint64_t offset )
+{
+    OperationScope scope(op_metrics_, Metrics::kSeek);
+
+    if (!f)
+        return false;
+
+    lock_guard lock(f->m_);
+
+    if (f->mode_ == FileMode::kWriteOnly && f->stripes_.empty() && !GetStorageFile(f->storage_).FlushFile(*f))
+        return false;
+
+    // дыр в файлах нет, поэтому позиция не может уйти за конец
+    if (offset > f->size_)
+        return false;
+
+    f->pos_ = offset;
+    return true;
+}
+
+uint64_t VFS::Tell( File *f )
+{
+    OperationScope scope(op_metrics_, Metrics::kTell);
+
+    if (!f)
+        return 0;
+
+    lock_guard lock(f->m_);
+    return f->pos_ + f->pending_.size();
+}
+
+size_t VFS::ReadAt( File *f, uint64_t offset, char *buff, size_t len )
+{
+    OperationScope scope(op_metrics_, Metrics::kReadAt);
+
+    if (!f || !buff || f->mode_ != FileMode::kReadOnly)
+        return 0;
+
+    lock_guard lock(f->m_);
+
+    uint64_t pos = f->pos_;
+    f->pos_ = offset;
+    size_t read = f->stripes_.empty() ? GetStorageFile(f->storage_).ReadFile(*f, buff, len) : ReadStriped(*f, buff, len);
+    f->pos_ = pos;
+
+    return scope.Bytes(read);
+}
+
+size_t VFS::WriteAt( File *f, uint64_t offset, const char *buff, size_t len )
+{
+    OperationScope scope(op_metrics_, Metrics::kWriteAt);
+
+    if (!f || !buff || f->mode_ != FileMode::kWriteOnly)
+        return 0;
+
+    lock_guard lock(f->m_);
+
+    if (!GetStorageFile(f->storage_).FlushFile(*f) || offset > f->size_)
+        return 0;
+
+    uint64_t pos = f->pos_;
+    f->pos_ = offset;
+
+    size_t written = 0;
+    if (f->stripes_.empty())
+    {
+        written = GetStorageFile(f->storage_).WriteFile(*f, buff, len);
+    }
+    else
+    {
+        iovec iov{ const_cast<char*>(buff), len };
+        written = WriteStriped(*f, &iov, 1);
+    }
+
+    f->pos_ = pos;
+
+    return scope.Bytes(written);
 }
 
 void VFS::Close( File *f )
 {
+    OperationScope scope(op_metrics_, Metrics::kClose);
+
+    if (!f)
+        return;
 
+    // у разбитого файла на диске есть только его полосы
+    vector<File*> parts = f->stripes_;
+    if (parts.empty())
+        parts.push_back(f);
+
+    // сброс и фиксация идут под блокировками своего контейнера; пока описатель не отпущен,
+    // второй писатель того же пути не откроется
+    for (auto* part : parts)
+    {
+        if (part->mode_ == FileMode::kWriteOnly)
+        {
+            auto& storage = GetStorageFile(part->storage_);
+            storage.FlushFile(*part);
+            storage.TrimFile(*part);
+            storage.CommitFile(part->path_, part->size_, part->extents_, part->inline_data_);
+        }
+
+        if (part != f)
+            delete part;
+    }
+
+    if (f->mode_ == FileMode::kWriteOnly)
+        EnsureSpareStorage();
+
+    {
+        unique_lock lock(m_);
+        auto it = opened_files_.find(f->path_);
+        if (it != opened_files_.end() && --it->second.opened_ == 0)
+            opened_files_.erase(it);
+    }
+
+    delete f;
 }
 
 
 
-}
\ No newline at end of file
+}